@@ -1357,6 +1357,8 @@ public:
   long get_openssl_verify_result() const;
 
   SSL_CTX *ssl_context() const;
+
+  void set_ssl_setup(std::function<void(SSL *ssl)> ssl_setup);
 #endif
 
 private:
@@ -1414,6 +1416,9 @@ public:
 
   SSL_CTX *ssl_context() const;
 
+  // called with each new SSL before the handshake (e.g. SSL_set_session)
+  void set_ssl_setup(std::function<void(SSL *ssl)> ssl_setup);
+
 private:
   bool create_and_connect_socket(Socket &socket, Error &error) override;
   void shutdown_ssl(Socket &socket, bool shutdown_gracefully) override;
@@ -1444,6 +1449,8 @@ private:
   std::string ca_cert_dir_path_;
   long verify_result_ = 0;
 
+  std::function<void(SSL *ssl)> ssl_setup_;
+
   friend class ClientImpl;
 };
 #endif
@@ -5869,7 +5876,7 @@ inline bool ClientImpl::process_request(Stream &strm, Request &req,
   }
 
   // Body
-  if ((res.status != 204) && req.method != "HEAD" && req.method != "CONNECT") {
+  if ((res.status != 204) && (res.status != 304) && req.method != "HEAD" && req.method != "CONNECT") {
     auto redirect = 300 < res.status && res.status < 400 && follow_location_;
 
     if (req.response_handler && !redirect) {
@@ -6914,6 +6921,10 @@ inline long SSLClient::get_openssl_verify_result() const {
 
 inline SSL_CTX *SSLClient::ssl_context() const { return ctx_; }
 
+inline void SSLClient::set_ssl_setup(std::function<void(SSL *ssl)> ssl_setup) {
+  ssl_setup_ = std::move(ssl_setup);
+}
+
 inline bool SSLClient::create_and_connect_socket(Socket &socket, Error &error) {
   return is_valid() && ClientImpl::create_and_connect_socket(socket, error);
 }
@@ -7049,6 +7060,7 @@ inline bool SSLClient::initialize_ssl(Socket &socket, Error &error) {
       },
       [&](SSL *ssl) {
         SSL_set_tlsext_host_name(ssl, host_.c_str());
+        if (ssl_setup_) { ssl_setup_(ssl); }
         return true;
       });
 
@@ -7658,6 +7670,12 @@ inline SSL_CTX *Client::ssl_context() const {
   if (is_ssl_) { return static_cast<SSLClient &>(*cli_).ssl_context(); }
   return nullptr;
 }
+
+inline void Client::set_ssl_setup(std::function<void(SSL *ssl)> ssl_setup) {
+  if (is_ssl_) {
+    static_cast<SSLClient &>(*cli_).set_ssl_setup(std::move(ssl_setup));
+  }
+}
 #endif
 
 // ----------------------------------------------------------------------------
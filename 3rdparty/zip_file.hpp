@@ -34,6 +34,9 @@
 #include <string>
 #include <time.h>
 #include <vector>
+#ifdef MINIZ_INFLATE_STREAM_FUNC
+#include <functional>
+#endif
 
 /* miniz.c v1.15 - public domain deflate/inflate, zlib-subset, ZIP reading/writing/appending, PNG writing
    See "unlicense" statement at the end of this file.
@@ -1034,6 +1037,14 @@ mz_ulong mz_adler32(mz_ulong adler, const unsigned char *ptr, size_t buf_len)
   return (s2 << 16) + s1;
 }
 
+#ifdef MINIZ_CRC32_FUNC
+// CRC-32 supplied by the includer, mz_uint32 MINIZ_CRC32_FUNC(mz_uint32 crc, const void *ptr, size_t buf_len)
+mz_ulong mz_crc32(mz_ulong crc, const mz_uint8 *ptr, size_t buf_len)
+{
+  if (!ptr) return MZ_CRC32_INIT;
+  return MINIZ_CRC32_FUNC((mz_uint32)crc, ptr, buf_len);
+}
+#else
 // Karl Malbrain's compact CRC-32. See "A compact CCITT crc16 and crc32 C implementation that balances processor cache usage against speed": http://www.geocities.com/malbrain/
 mz_ulong mz_crc32(mz_ulong crc, const mz_uint8 *ptr, size_t buf_len)
 {
@@ -1044,6 +1055,7 @@ mz_ulong mz_crc32(mz_ulong crc, const mz_uint8 *ptr, size_t buf_len)
   crcu32 = ~crcu32; while (buf_len--) { mz_uint8 b = *ptr++; crcu32 = (crcu32 >> 4) ^ s_crc32[(crcu32 & 0xF) ^ (b & 0xF)]; crcu32 = (crcu32 >> 4) ^ s_crc32[(crcu32 & 0xF) ^ (b >> 4)]; }
   return ~crcu32;
 }
+#endif // MINIZ_CRC32_FUNC
 
 void mz_free(void *p)
 {
@@ -3645,6 +3657,18 @@ mz_bool mz_zip_reader_extract_to_mem_no_alloc(mz_zip_archive *pZip, mz_uint file
     return ((flags & MZ_ZIP_FLAG_COMPRESSED_DATA) != 0) || (mz_crc32(MZ_CRC32_INIT, (const mz_uint8 *)pBuf, (size_t)file_stat.m_uncomp_size) == file_stat.m_crc32);
   }
 
+#ifdef MINIZ_INFLATE_FUNC
+  // Inflate supplied by the includer for archives in memory,
+  // int MINIZ_INFLATE_FUNC(const void *pSrc, size_t src_len, void *pDst, size_t dst_len, size_t *pDst_written) ; 1 done, 0 failed, -1 use tinfl
+  if (pZip->m_pState->m_pMem)
+  {
+    size_t written = 0;
+    int result = MINIZ_INFLATE_FUNC((const mz_uint8 *)pZip->m_pState->m_pMem + cur_file_ofs, (size_t)file_stat.m_comp_size, pBuf, (size_t)file_stat.m_uncomp_size, &written);
+    if (result >= 0)
+      return result && (written == file_stat.m_uncomp_size) && (mz_crc32(MZ_CRC32_INIT, (const mz_uint8 *)pBuf, (size_t)file_stat.m_uncomp_size) == file_stat.m_crc32);
+  }
+#endif // MINIZ_INFLATE_FUNC
+
   // Decompress the file either directly from memory or from a file input buffer.
   tinfl_init(&inflator);
 
@@ -3880,50 +3904,70 @@ mz_bool mz_zip_reader_extract_to_callback(mz_zip_archive *pZip, mz_uint file_ind
   }
   else
   {
-    tinfl_decompressor inflator;
-    tinfl_init(&inflator);
-
-    if (NULL == (pWrite_buf = pZip->m_pAlloc(pZip->m_pAlloc_opaque, 1, TINFL_LZ_DICT_SIZE)))
-      status = TINFL_STATUS_FAILED;
-    else
+#ifdef MINIZ_INFLATE_STREAM_FUNC
+    // Inflate supplied by the includer for archives in memory, passing the output in pieces,
+    // int MINIZ_INFLATE_STREAM_FUNC(const void *pSrc, size_t src_len, const std::function<bool(const mz_uint8 *pData, size_t n)> &output) ; 1 done, 0 failed, -1 use tinfl
+    int result = -1;
+    if (pZip->m_pState->m_pMem)
     {
-      do
+      result = MINIZ_INFLATE_STREAM_FUNC(pRead_buf, (size_t)file_stat.m_comp_size, [&](const mz_uint8 *pData, size_t n) -> bool
+      {
+        if (pCallback(pOpaque, out_buf_ofs, pData, n) != n)
+          return false;
+        file_crc32 = (mz_uint32)mz_crc32(file_crc32, pData, n);
+        return (out_buf_ofs += n) <= file_stat.m_uncomp_size;
+      });
+      if (result >= 0)
+        status = result ? TINFL_STATUS_DONE : TINFL_STATUS_FAILED;
+    }
+    if (result < 0)
+#endif // MINIZ_INFLATE_STREAM_FUNC
+    {
+      tinfl_decompressor inflator;
+      tinfl_init(&inflator);
+
+      if (NULL == (pWrite_buf = pZip->m_pAlloc(pZip->m_pAlloc_opaque, 1, TINFL_LZ_DICT_SIZE)))
+        status = TINFL_STATUS_FAILED;
+      else
       {
-        mz_uint8 *pWrite_buf_cur = (mz_uint8 *)pWrite_buf + (out_buf_ofs & (TINFL_LZ_DICT_SIZE - 1));
-        size_t in_buf_size, out_buf_size = TINFL_LZ_DICT_SIZE - (out_buf_ofs & (TINFL_LZ_DICT_SIZE - 1));
-        if ((!read_buf_avail) && (!pZip->m_pState->m_pMem))
+        do
         {
-          read_buf_avail = MZ_MIN(read_buf_size, comp_remaining);
-          if (pZip->m_pRead(pZip->m_pIO_opaque, cur_file_ofs, pRead_buf, (size_t)read_buf_avail) != read_buf_avail)
+          mz_uint8 *pWrite_buf_cur = (mz_uint8 *)pWrite_buf + (out_buf_ofs & (TINFL_LZ_DICT_SIZE - 1));
+          size_t in_buf_size, out_buf_size = TINFL_LZ_DICT_SIZE - (out_buf_ofs & (TINFL_LZ_DICT_SIZE - 1));
+          if ((!read_buf_avail) && (!pZip->m_pState->m_pMem))
           {
-            status = TINFL_STATUS_FAILED;
-            break;
+            read_buf_avail = MZ_MIN(read_buf_size, comp_remaining);
+            if (pZip->m_pRead(pZip->m_pIO_opaque, cur_file_ofs, pRead_buf, (size_t)read_buf_avail) != read_buf_avail)
+            {
+              status = TINFL_STATUS_FAILED;
+              break;
+            }
+            cur_file_ofs += read_buf_avail;
+            comp_remaining -= read_buf_avail;
+            read_buf_ofs = 0;
           }
-          cur_file_ofs += read_buf_avail;
-          comp_remaining -= read_buf_avail;
-          read_buf_ofs = 0;
-        }
 
-        in_buf_size = (size_t)read_buf_avail;
-        status = tinfl_decompress(&inflator, (const mz_uint8 *)pRead_buf + read_buf_ofs, &in_buf_size, (mz_uint8 *)pWrite_buf, pWrite_buf_cur, &out_buf_size, comp_remaining ? TINFL_FLAG_HAS_MORE_INPUT : 0);
-        read_buf_avail -= in_buf_size;
-        read_buf_ofs += in_buf_size;
+          in_buf_size = (size_t)read_buf_avail;
+          status = tinfl_decompress(&inflator, (const mz_uint8 *)pRead_buf + read_buf_ofs, &in_buf_size, (mz_uint8 *)pWrite_buf, pWrite_buf_cur, &out_buf_size, comp_remaining ? TINFL_FLAG_HAS_MORE_INPUT : 0);
+          read_buf_avail -= in_buf_size;
+          read_buf_ofs += in_buf_size;
 
-        if (out_buf_size)
-        {
-          if (pCallback(pOpaque, out_buf_ofs, pWrite_buf_cur, out_buf_size) != out_buf_size)
-          {
-            status = TINFL_STATUS_FAILED;
-            break;
-          }
-          file_crc32 = (mz_uint32)mz_crc32(file_crc32, pWrite_buf_cur, out_buf_size);
-          if ((out_buf_ofs += out_buf_size) > file_stat.m_uncomp_size)
+          if (out_buf_size)
           {
-            status = TINFL_STATUS_FAILED;
-            break;
+            if (pCallback(pOpaque, out_buf_ofs, pWrite_buf_cur, out_buf_size) != out_buf_size)
+            {
+              status = TINFL_STATUS_FAILED;
+              break;
+            }
+            file_crc32 = (mz_uint32)mz_crc32(file_crc32, pWrite_buf_cur, out_buf_size);
+            if ((out_buf_ofs += out_buf_size) > file_stat.m_uncomp_size)
+            {
+              status = TINFL_STATUS_FAILED;
+              break;
+            }
           }
-        }
-      } while ((status == TINFL_STATUS_NEEDS_MORE_INPUT) || (status == TINFL_STATUS_HAS_MORE_OUTPUT));
+        } while ((status == TINFL_STATUS_NEEDS_MORE_INPUT) || (status == TINFL_STATUS_HAS_MORE_OUTPUT));
+      }
     }
   }
 
@@ -5205,6 +5249,31 @@ public:
         start_read();
     }
 
+    // read only, without copying ; data (e.g. a memory mapped file) must outlive this object
+    void load_view(const void *data, std::size_t size)
+    {
+        reset();
+        buffer_.clear();
+
+        if(!mz_zip_reader_init_mem(archive_.get(), data, size, 0))
+        {
+            throw std::runtime_error("bad zip");
+        }
+    }
+
+    // read only, through miniz's file reader ; only the central directory is kept in memory
+    void load_file(const std::string &filename)
+    {
+        reset();
+        buffer_.clear();
+        filename_ = filename;
+
+        if(!mz_zip_reader_init_file(archive_.get(), filename.c_str(), 0))
+        {
+            throw std::runtime_error("bad zip");
+        }
+    }
+
     void save(const std::string &filename)
     {
         filename_ = filename;
@@ -5355,23 +5424,50 @@ public:
 
     std::ostream &open(const zip_info &name)
     {
-        auto data = read(name);
-        std::string data_string(data.begin(), data.end());
-        open_stream_ << data_string;
+        open_stream_.str(std::string()); // previously opened member
+        open_stream_.clear();
+        open_stream_ << read(name);
         return open_stream_;
     }
-    
+
+    // inflates the member straight into the stream, without intermediate copies
+    bool extract_to(const zip_info &member, std::ostream &stream)
+    {
+        if(archive_->m_zip_mode != MZ_ZIP_MODE_READING)
+        {
+            start_read();
+        }
+
+        int index = mz_zip_reader_locate_file(archive_.get(), member.filename.c_str(), nullptr, 0);
+
+        if(index == -1)
+        {
+            throw std::runtime_error("not found");
+        }
+
+        auto write = [](void *opaque, mz_uint64, const void *data, std::size_t size) -> std::size_t
+        {
+            auto &out = *static_cast<std::ostream *>(opaque);
+            out.write(static_cast<const char *>(data), static_cast<std::streamsize>(size));
+            return out.good() ? size : 0;
+        };
+
+        return mz_zip_reader_extract_to_callback(archive_.get(), static_cast<mz_uint>(index), write, &stream, 0) == MZ_TRUE;
+    }
+
     void extract(const std::string &member, const std::string &path)
     {
-        std::fstream stream(detail::join_path({path, member}), std::ios::binary | std::ios::out);
-        stream << open(member).rdbuf();
+        extract(getinfo(member), path);
     }
 
     void extract(const zip_info &member, const std::string &path)
     {
         std::fstream stream(detail::join_path({path, member.filename}), std::ios::binary | std::ios::out);
         assert(stream.is_open());
-        stream << open(member).rdbuf();
+        if(!extract_to(member, stream))
+        {
+            throw std::runtime_error("file couldn't be extracted");
+        }
     }
 
     void extractall(const std::string &path)
@@ -0,0 +1,415 @@
+// zip 처리에 쓰이는 kernel 들의 처리량 측정
+//   MicroBenchmark.exe [size in MB] [repetitions]
+// 각 kernel 을 WARMUP 회 돌린 뒤 repetitions 회 재고, 회당 시간의 백분위와 중앙값의 처리량을 보인다.
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../crc32.h"
+#include "../inflate.h"
+#define MINIZ_CRC32_FUNC Crc32 // patcher 와 같은 설정 ; read/extract 의 crc 검증 비용도 patcher 와 같다.
+#define MINIZ_INFLATE_FUNC InflateForMiniz
+#define MINIZ_INFLATE_STREAM_FUNC InflateStreamForMiniz
+#include "../3rdparty/zip_file.hpp"
+
+using namespace std;
+
+const int WARMUP = 2;
+const size_t EXTRACT_WRITE_BUFFER_SIZE = 256 * 1024; // main.cpp 와 같은 크기
+
+// miniz 원래의 mz_crc32 (Karl Malbrain's compact CRC-32) ; 비교 기준
+uint32_t Crc32Nibble(uint32_t crc, const uint8_t* ptr, size_t size)
+{
+    static const uint32_t TABLE[16] = { 0, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+        0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c, 0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c };
+    crc = ~crc;
+    while (size--)
+    {
+        const uint8_t b = *ptr++;
+        crc = (crc >> 4) ^ TABLE[(crc & 0xF) ^ (b & 0xF)];
+        crc = (crc >> 4) ^ TABLE[(crc & 0xF) ^ (b >> 4)];
+    }
+    return ~crc;
+}
+
+// 회당 걸린 시간(초), 정렬되어 있다.
+struct Samples
+{
+    vector<double> seconds;
+
+    // nearest-rank
+    double Percentile(double p) const
+    {
+        const auto rank = static_cast<size_t>(p / 100.0 * seconds.size() + 0.5);
+        return seconds[min(max<size_t>(rank, 1), seconds.size()) - 1];
+    }
+};
+
+template<class Function>
+Samples Measure(int repeat, Function function)
+{
+    for (int i = 0; i < WARMUP; ++i) function();
+    Samples samples;
+    for (int i = 0; i < repeat; ++i)
+    {
+        auto begin = chrono::steady_clock::now();
+        function();
+        chrono::duration<double> elapsed = chrono::steady_clock::now() - begin;
+        samples.seconds.push_back(elapsed.count());
+    }
+    sort(samples.seconds.begin(), samples.seconds.end());
+    return samples;
+}
+
+void PrintHeader(const string& title)
+{
+    cout << title << endl << "  " << left << setw(44) << "" << right
+        << setw(10) << "min ms" << setw(10) << "p50 ms" << setw(10) << "p90 ms" << setw(10) << "p99 ms" << setw(16) << "p50 rate" << endl;
+}
+
+// amount 는 한 회에 처리한 양 ; rate 는 중앙값 기준
+void PrintSamples(const string& name, const Samples& samples, double amount, const char* unit, double baseline = 0)
+{
+    const auto rate = amount / samples.Percentile(50);
+    cout << "  " << left << setw(44) << name << right << fixed << setprecision(3)
+        << setw(10) << samples.Percentile(0) * 1000 << setw(10) << samples.Percentile(50) * 1000
+        << setw(10) << samples.Percentile(90) * 1000 << setw(10) << samples.Percentile(99) * 1000
+        << setprecision(1) << setw(10) << rate << " " << unit;
+    if (baseline > 0) cout << setw(8) << rate / baseline << "x";
+    cout << endl;
+}
+
+double ToMB(size_t bytes)
+{
+    return bytes / (1024.0 * 1024.0);
+}
+
+// 압축이 잘 되는 text 또는 압축되지 않는 난수
+vector<uint8_t> MakeCorpus(size_t size, bool compressible)
+{
+    static const char* WORDS[] = { "patch", "version", "manifest", "package", "file", "zip", "range", "chunk", "delta", "install" };
+    vector<uint8_t> data;
+    data.reserve(size + 16);
+    mt19937 random(1234);
+    if (compressible)
+    {
+        while (data.size() < size)
+        {
+            const string word = WORDS[random() % (sizeof(WORDS) / sizeof(WORDS[0]))];
+            data.insert(data.end(), word.begin(), word.end());
+            data.push_back((random() % 8 == 0) ? '\n' : ' ');
+        }
+    }
+    data.resize(size);
+    if (compressible == false) for (auto& b : data) b = static_cast<uint8_t>(random());
+    return data;
+}
+
+// corpus 를 entrySize 씩 나눈 entry 들의 zip ; 배포 도구들의 기본값처럼 level 6 으로 압축한다.
+vector<unsigned char> MakeZip(const vector<uint8_t>& corpus, size_t entrySize)
+{
+    mz_zip_archive archive{};
+    void* buffer = nullptr;
+    size_t size = 0;
+    bool succeeded = mz_zip_writer_init_heap(&archive, 0, corpus.size() + 1024 * 1024) == MZ_TRUE;
+    for (size_t offset = 0, i = 0; succeeded && offset < corpus.size(); offset += entrySize, ++i)
+    {
+        const auto& name = "data/" + to_string(i % 100) + "/file" + to_string(i) + ".bin";
+        succeeded = mz_zip_writer_add_mem(&archive, name.c_str(), corpus.data() + offset, min(entrySize, corpus.size() - offset), MZ_DEFAULT_LEVEL) == MZ_TRUE;
+    }
+    succeeded = succeeded && mz_zip_writer_finalize_heap_archive(&archive, &buffer, &size) == MZ_TRUE;
+    mz_zip_writer_end(&archive);
+    vector<unsigned char> zip;
+    if (succeeded) zip.assign(static_cast<unsigned char*>(buffer), static_cast<unsigned char*>(buffer) + size);
+    mz_free(buffer);
+    return zip;
+}
+
+bool BenchmarkCrc32(const vector<uint8_t>& data, int repeat)
+{
+    struct Candidate
+    {
+        const char* name;
+        function<uint32_t()> run;
+    };
+    const Candidate candidates[] =
+    {
+        { "mz_crc32 (nibble table)", [&]() { return Crc32Nibble(0, data.data(), data.size()); } },
+        { "slice-by-8", [&]() { return Crc32Slice8(0, data.data(), data.size()); } },
+        { "slice-by-16", [&]() { return Crc32Slice16(0, data.data(), data.size()); } },
+        { "Crc32", [&]() { return Crc32(0, data.data(), data.size()); } },
+    };
+
+    PrintHeader("crc32, " + to_string(data.size() / (1024 * 1024)) + "MB, Crc32 uses " + GetCrc32ImplementationName());
+    const auto expected = candidates[0].run();
+    double baseline = 0;
+    for (const auto& c : candidates)
+    {
+        volatile uint32_t result = 0;
+        auto samples = Measure(repeat, [&]() { result = c.run(); });
+        if (result != expected)
+        {
+            cerr << "  " << c.name << " : wrong result " << hex << result << " != " << expected << dec << endl;
+            return false;
+        }
+        if (baseline == 0) baseline = ToMB(data.size()) / samples.Percentile(50);
+        PrintSamples(c.name, samples, ToMB(data.size()), "MB/s", baseline);
+    }
+    return true;
+}
+
+// raw deflate stream 을 한 번에 푼다. (rate 는 풀린 크기 기준)
+// 빠른 decoder 는 tinfl 과 byte 단위로 같은 출력이어야 한다 ; tdefl 의 block 종류마다 확인한다.
+bool BenchmarkInflate(const char* name, const vector<uint8_t>& data, int repeat)
+{
+    struct Stream
+    {
+        const char* name;
+        int flags;
+    };
+    const Stream streams[] =
+    {
+        { "dynamic", TDEFL_DEFAULT_MAX_PROBES },
+        { "static", TDEFL_DEFAULT_MAX_PROBES | TDEFL_FORCE_ALL_STATIC_BLOCKS },
+        { "stored", TDEFL_FORCE_ALL_RAW_BLOCKS },
+        { "huffman only", TDEFL_HUFFMAN_ONLY },
+    };
+    struct Candidate
+    {
+        const char* name;
+        function<size_t(const void*, size_t, vector<uint8_t>&)> run; // 풀린 크기, 실패하면 0
+    };
+    const Candidate candidates[] =
+    {
+        { "tinfl", [](const void* in, size_t size, vector<uint8_t>& out)
+            {
+                const auto written = tinfl_decompress_mem_to_mem(out.data(), out.size(), in, size, 0);
+                return written == TINFL_DECOMPRESS_MEM_TO_MEM_FAILED ? 0 : written;
+            } },
+        { "InflateTo", [](const void* in, size_t size, vector<uint8_t>& out)
+            {
+                size_t written = 0;
+                return InflateTo(in, size, out.data(), out.size(), written) ? written : 0;
+            } },
+        { "tinfl (stream)", [](const void* in, size_t size, vector<uint8_t>& out)
+            { // zip_file 의 extract_to_callback 처럼 32KB 사전을 돌려 쓰며 조각으로 넘긴다.
+                tinfl_decompressor inflator;
+                tinfl_init(&inflator);
+                vector<mz_uint8> dictionary(TINFL_LZ_DICT_SIZE);
+                size_t inOffset = 0;
+                size_t dictionaryOffset = 0;
+                size_t written = 0;
+                for (;;)
+                {
+                    size_t inSize = size - inOffset;
+                    size_t outSize = TINFL_LZ_DICT_SIZE - dictionaryOffset;
+                    const auto status = tinfl_decompress(&inflator, static_cast<const mz_uint8*>(in) + inOffset, &inSize
+                        , dictionary.data(), dictionary.data() + dictionaryOffset, &outSize, 0);
+                    inOffset += inSize;
+                    if (written + outSize > out.size()) return size_t(0);
+                    memcpy(out.data() + written, dictionary.data() + dictionaryOffset, outSize);
+                    written += outSize;
+                    dictionaryOffset = (dictionaryOffset + outSize) & (TINFL_LZ_DICT_SIZE - 1);
+                    if (status == TINFL_STATUS_DONE) return written;
+                    if (status != TINFL_STATUS_HAS_MORE_OUTPUT) return size_t(0);
+                }
+            } },
+        { "Inflate (stream)", [](const void* in, size_t size, vector<uint8_t>& out)
+            {
+                size_t written = 0;
+                auto succeeded = Inflate(in, size, [&](const uint8_t* data, size_t length)
+                    {
+                        if (written + length > out.size()) return false;
+                        memcpy(out.data() + written, data, length);
+                        written += length;
+                        return true;
+                    });
+                return succeeded ? written : 0;
+            } },
+    };
+
+    vector<uint8_t> expected(data.size());
+    vector<uint8_t> output(data.size());
+    for (const auto& stream : streams)
+    {
+        size_t compressedSize = 0;
+        auto compressed = tdefl_compress_mem_to_heap(data.data(), data.size(), &compressedSize, stream.flags);
+        if (compressed == nullptr)
+        {
+            cerr << "  " << name << " : could not compress" << endl;
+            return false;
+        }
+        double baseline = 0;
+        for (const auto& c : candidates)
+        {
+            size_t outputSize = 0;
+            auto samples = Measure(repeat, [&]() { outputSize = c.run(compressed, compressedSize, output); });
+            if (baseline == 0) expected = output; // tinfl
+            if (outputSize != data.size() || output != data || output != expected)
+            {
+                cerr << "  " << name << " " << stream.name << " " << c.name << " : wrong result" << endl;
+                mz_free(compressed);
+                return false;
+            }
+            if (baseline == 0) baseline = ToMB(data.size()) / samples.Percentile(50);
+            PrintSamples(string(name) + " " + stream.name + " (" + to_string(compressedSize * 100 / data.size()) + "%) " + c.name
+                , samples, ToMB(data.size()), "MB/s", baseline);
+        }
+        mz_free(compressed);
+    }
+    return true;
+}
+
+uint64_t GetTotalSize(const vector<miniz_cpp::zip_info>& infos)
+{
+    uint64_t total = 0;
+    for (const auto& info : infos) total += info.file_size;
+    return total;
+}
+
+// central directory 를 읽어 zip_info 들을 만든다.
+bool BenchmarkInfolist(const char* name, const vector<unsigned char>& bytes, int repeat)
+{
+    miniz_cpp::zip_file zip(bytes);
+    size_t count = 0;
+    auto samples = Measure(repeat, [&]() { count = zip.infolist().size(); });
+    if (count == 0)
+    {
+        cerr << "  " << name << " : no entries" << endl;
+        return false;
+    }
+    PrintSamples(string(name) + " (" + to_string(count) + " entries)", samples, count / 1000.0, "K entries/s");
+    return true;
+}
+
+// 모든 entry 를 memory 로 푼다. (crc 검증 포함)
+bool BenchmarkRead(const string& name, const vector<unsigned char>& bytes, int repeat)
+{
+    miniz_cpp::zip_file zip(bytes);
+    const auto& infos = zip.infolist();
+    uint64_t readBytes = 0;
+    auto samples = Measure(repeat, [&]()
+        {
+            readBytes = 0;
+            for (const auto& info : infos) readBytes += zip.read(info).size();
+        });
+    if (readBytes != GetTotalSize(infos))
+    {
+        cerr << "  " << name << " : wrong size" << endl;
+        return false;
+    }
+    PrintSamples(name, samples, ToMB(static_cast<size_t>(readBytes)), "MB/s");
+    return true;
+}
+
+// ExtractEntry 처럼 큰 buffer 의 ofstream 으로 바로 푼다. directory 는 미리 만들어 둔다.
+bool BenchmarkExtract(const string& name, const vector<unsigned char>& bytes, const filesystem::path& dest, int repeat)
+{
+    miniz_cpp::zip_file zip(bytes);
+    const auto& infos = zip.infolist();
+    error_code ec;
+    for (const auto& info : infos) filesystem::create_directories((dest / filesystem::u8path(info.filename)).parent_path(), ec);
+
+    vector<char> writeBuffer(EXTRACT_WRITE_BUFFER_SIZE);
+    bool succeeded = true;
+    auto samples = Measure(repeat, [&]()
+        {
+            for (const auto& info : infos)
+            {
+                ofstream file;
+                file.rdbuf()->pubsetbuf(writeBuffer.data(), static_cast<streamsize>(writeBuffer.size()));
+                file.open(dest / filesystem::u8path(info.filename), ofstream::binary);
+                if (file.is_open()) file.rdbuf()->pubsetbuf(writeBuffer.data(), static_cast<streamsize>(writeBuffer.size()));
+                succeeded = zip.extract_to(info, file) && succeeded;
+                file.close();
+                succeeded = file.fail() == false && succeeded;
+            }
+        });
+    filesystem::remove_all(dest, ec);
+    if (succeeded == false)
+    {
+        cerr << "  " << name << " : could not extract to " << dest.u8string() << endl;
+        return false;
+    }
+    PrintSamples(name, samples, ToMB(static_cast<size_t>(GetTotalSize(infos))), "MB/s");
+    return true;
+}
+
+int main(int argc, const char** argv)
+{
+    const size_t size = (argc > 1 ? stoul(argv[1]) : 64) * 1024 * 1024;
+    const int repeat = argc > 2 ? stoi(argv[2]) : 15;
+
+    const auto& text = MakeCorpus(size, true);
+    const auto& random = MakeCorpus(size, false);
+
+    if (BenchmarkCrc32(random, repeat) == false) return 1;
+
+    PrintHeader("inflate, " + to_string(size / (1024 * 1024)) + "MB, raw deflate by tdefl");
+    if (BenchmarkInflate("text", text, repeat) == false) return 1;
+    if (BenchmarkInflate("random", random, repeat) == false) return 1;
+
+    // 작은 파일이 많은 package 와 큰 파일이 적은 package
+    const size_t SMALL_ENTRY_SIZE = 16 * 1024;
+    const size_t LARGE_ENTRY_SIZE = max<size_t>(size / 4, 1);
+    const struct
+    {
+        const char* name;
+        vector<unsigned char> zip;
+    } packages[] =
+    {
+        { "small text", MakeZip(text, SMALL_ENTRY_SIZE) },
+        { "small random", MakeZip(random, SMALL_ENTRY_SIZE) },
+        { "large text", MakeZip(text, LARGE_ENTRY_SIZE) },
+        { "large random", MakeZip(random, LARGE_ENTRY_SIZE) },
+    };
+    for (const auto& p : packages)
+    {
+        if (p.zip.empty())
+        {
+            cerr << "could not make the " << p.name << " zip" << endl;
+            return 1;
+        }
+    }
+
+    PrintHeader("zip_file::infolist()");
+    if (BenchmarkInfolist(packages[0].name, packages[0].zip, repeat) == false) return 1;
+    if (BenchmarkInfolist(packages[2].name, packages[2].zip, repeat) == false) return 1;
+
+    // 같은 zip 을 inflate backend 마다
+    const struct
+    {
+        InflateBackend backend;
+        const char* name;
+    } backends[] = { { InflateBackend::TINFL, "tinfl" }, { InflateBackend::FAST, "fast" } };
+
+    PrintHeader("zip_file::read(), all entries");
+    for (const auto& p : packages)
+    {
+        for (const auto& b : backends)
+        {
+            SetInflateBackend(b.backend);
+            if (BenchmarkRead((string(p.name) + " " + b.name).c_str(), p.zip, repeat) == false) return 1;
+        }
+    }
+
+    const auto& dest = filesystem::temp_directory_path() / "micro_benchmark_extract";
+    PrintHeader("zip_file::extract_to() into files, " + dest.u8string());
+    for (const auto& p : packages)
+    {
+        for (const auto& b : backends)
+        {
+            SetInflateBackend(b.backend);
+            if (BenchmarkExtract((string(p.name) + " " + b.name).c_str(), p.zip, dest, repeat) == false) return 1;
+        }
+    }
+    return 0;
+}
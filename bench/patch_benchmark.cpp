@@ -0,0 +1,546 @@
+// 합성 package 를 in-process http server 로 내보내고 patcher 전체 흐름(설치, manifest 갱신, 최신 확인)을 잰다.
+//   PatchBenchmark.exe <patcher> [--latency ms] [--bandwidth KB/s] [--scale %] [--repeat N] [-- patcher args]
+// patcher 는 회마다 별도 process 로 띄워 peak RSS 와 I/O 횟수를 그 회의 것만 얻는다.
+
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../3rdparty/args.hxx"
+#include "../3rdparty/httplib.h" // server 만 쓰므로 https 는 필요 없다.
+#include "../3rdparty/zip_file.hpp"
+#include "../3rdparty/json_struct.h"
+
+#ifdef _WIN32
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+// main.cpp 의 VersionInfo 중 benchmark 에 필요한 것
+struct VersionInfo
+{
+    string Version;
+    string ZipFileUrl;
+    string ExecutePath;
+    string ManifestUrl;
+    vector<string> Arguments;
+
+    JS_OBJ(Version, ZipFileUrl, ExecutePath, ManifestUrl, Arguments);
+};
+
+// main.cpp 의 --metrics-out 형식
+struct MetricsPhase
+{
+    string Name;
+    size_t Count = 0;
+    double Seconds = 0;
+    double BusySeconds = 0;
+    uint64_t Bytes = 0;
+    uint64_t Files = 0;
+    double BytesPerSecond = 0;
+
+    JS_OBJ(Name, Count, Seconds, BusySeconds, Bytes, Files, BytesPerSecond);
+};
+
+struct MetricsReport
+{
+    double TotalSeconds = 0;
+    vector<MetricsPhase> Phases;
+
+    JS_OBJ(TotalSeconds, Phases);
+};
+
+struct Scenario
+{
+    const char* name;
+    size_t fileCount;
+    size_t fileSize;
+    bool compressible;
+};
+
+// 압축이 잘 되는 text 또는 압축되지 않는 난수
+string MakeContent(size_t length, bool compressible, uint32_t seed)
+{
+    static const char* WORDS[] = { "patch", "version", "manifest", "package", "file", "zip", "range", "chunk", "delta", "install" };
+    mt19937 random(seed);
+    string content;
+    content.reserve(length + 16);
+    if (compressible)
+    {
+        while (content.size() < length)
+        {
+            content += WORDS[random() % size(WORDS)];
+            content += (random() % 8 == 0) ? '\n' : ' ';
+        }
+        content.resize(length);
+        return content;
+    }
+    content.resize(length);
+    for (auto& c : content) c = static_cast<char>(random());
+    return content;
+}
+
+// version 이 바뀌면 열 개 중 하나의 파일만 바뀐다.
+bool MakePackage(const Scenario& scenario, int version, const filesystem::path& zipPath)
+{
+    miniz_cpp::zip_file zip;
+    for (size_t i = 0; i < scenario.fileCount; ++i)
+    {
+        const auto seed = static_cast<uint32_t>(i * 2 + (i % 10 == 0 ? version : 1));
+        stringstream name;
+        name << "data/" << setw(2) << setfill('0') << i % 100 << "/file" << i << ".bin";
+        zip.writestr(name.str(), MakeContent(scenario.fileSize, scenario.compressible, seed));
+    }
+    error_code ec;
+    filesystem::create_directories(zipPath.parent_path(), ec);
+    zip.save(zipPath.u8string());
+    return filesystem::exists(zipPath);
+}
+
+string ReadFile(const filesystem::path& path)
+{
+    ifstream file(path, ios::binary);
+    return string(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+}
+
+bool WriteFile(const filesystem::path& path, const string& content)
+{
+    ofstream file(path, ios::binary | ios::trunc);
+    return file.write(content.data(), content.size()).good();
+}
+
+// root 아래 파일을 내보낸다. 응답 전 latency 만큼 기다리고, 모든 연결이 bandwidth 를 나눠 쓴다.
+// 내용을 memory 에 두지 않아야 fork 한 patcher 의 peak RSS 에 benchmark 의 memory 가 섞이지 않는다.
+// /redirect/<path> 는 같은 origin 의 <path> 로 redirect 하고, 이어진 요청이 같은 연결로 왔는지 기록한다.
+class ShapedServer
+{
+public:
+    ShapedServer(const filesystem::path& root, chrono::milliseconds latency, size_t bytesPerSecond)
+        : root(root), latency(latency), bytesPerSecond(bytesPerSecond)
+    {
+        server.set_tcp_nodelay(true); // keep-alive 연결에서 header 와 body 를 따로 쓰면 Nagle 로 body 가 delayed ACK 만큼 늦는다.
+        server.Get(R"(/redirect/(.+))", [this](const httplib::Request& req, httplib::Response& res) { Redirect(req, res); });
+        server.Get(R"(/(.+))", [this](const httplib::Request& req, httplib::Response& res) { Serve(req, res); });
+    }
+
+    ~ShapedServer()
+    {
+        server.stop();
+        if (listener.joinable()) listener.join();
+    }
+
+    bool Start()
+    {
+        port = server.bind_to_any_port("127.0.0.1");
+        if (port <= 0) return false;
+        listener = thread([this]() { server.listen_after_bind(); });
+        return true;
+    }
+
+    string GetUrl(const string& path) const
+    {
+        return "http://127.0.0.1:" + to_string(port) + "/" + path;
+    }
+
+    uint64_t TakeSentBytes()
+    {
+        return sentBytes.exchange(0);
+    }
+
+    // 마지막으로 따라간 redirect 가 있었는지 ; outReused 는 redirect 를 받은 연결로 다시 요청했는지
+    bool TakeRedirect(bool& outReused)
+    {
+        lock_guard<mutex> lock(redirectLock);
+        const auto followed = redirectFollowed;
+        outReused = redirectReused;
+        redirectFollowed = redirectReused = false;
+        redirectPort = 0;
+        return followed;
+    }
+
+private:
+    void Redirect(const httplib::Request& req, httplib::Response& res)
+    {
+        this_thread::sleep_for(latency);
+        lock_guard<mutex> lock(redirectLock);
+        redirectPort = req.remote_port;
+        res.set_redirect(GetUrl(req.matches[1].str()));
+    }
+
+    void Serve(const httplib::Request& req, httplib::Response& res)
+    {
+        this_thread::sleep_for(latency);
+        {
+            lock_guard<mutex> lock(redirectLock);
+            if (redirectPort != 0)
+            {
+                redirectFollowed = true;
+                redirectReused = req.remote_port == redirectPort;
+                redirectPort = 0;
+            }
+        }
+        const auto& path = root / filesystem::u8path(req.matches[1].str());
+        error_code ec;
+        const auto fileSize = filesystem::file_size(path, ec);
+        auto file = make_shared<ifstream>(path, ios::binary);
+        if (ec || file->is_open() == false)
+        {
+            res.status = 404;
+            return;
+        }
+        res.set_content_provider(static_cast<size_t>(fileSize), "application/octet-stream", [this, file](size_t offset, size_t length, httplib::DataSink& sink)
+            {
+                char buffer[SEND_CHUNK_SIZE];
+                const auto size = min(length, SEND_CHUNK_SIZE);
+                if (file->seekg(offset).read(buffer, size).gcount() != static_cast<streamsize>(size)) return false;
+                Throttle(size);
+                if (sink.write(buffer, size) == false) return false;
+                sentBytes += size;
+                return true;
+            });
+    }
+
+    // 공유 회선 ; 보낼 차례가 올 때까지 기다린다.
+    void Throttle(size_t size)
+    {
+        if (bytesPerSecond == 0) return;
+        const auto duration = chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(static_cast<double>(size) / bytesPerSecond));
+        chrono::steady_clock::time_point sendAt;
+        {
+            lock_guard<mutex> lock(lineLock);
+            sendAt = max(chrono::steady_clock::now(), lineFreeAt);
+            lineFreeAt = sendAt + duration;
+        }
+        this_thread::sleep_until(sendAt + duration);
+    }
+
+    static constexpr size_t SEND_CHUNK_SIZE = 64 * 1024;
+
+    httplib::Server server;
+    thread listener;
+    int port = 0;
+    const filesystem::path root;
+    const chrono::milliseconds latency;
+    const size_t bytesPerSecond;
+    mutex lineLock;
+    chrono::steady_clock::time_point lineFreeAt;
+    atomic<uint64_t> sentBytes{ 0 };
+    mutex redirectLock;
+    int redirectPort = 0; // redirect 를 받은 client 의 port
+    bool redirectFollowed = false;
+    bool redirectReused = false;
+};
+
+struct RunResult
+{
+    int exitCode = -1;
+    double seconds = 0;
+    uint64_t peakMemory = 0; // bytes
+    uint64_t reads = 0; // windows: read 호출 수, posix: 읽은 block 수
+    uint64_t writes = 0; // windows: write 호출 수, posix: 쓴 block 수
+    uint64_t others = 0; // windows: 그 밖의 I/O 호출 수, posix: context switch 수
+};
+
+#ifdef _WIN32
+wstring QuoteArgument(const wstring& arg)
+{
+    if (arg.empty() == false && arg.find_first_of(L" \t\"") == wstring::npos) return arg;
+    wstring quoted = L"\"";
+    size_t backslashes = 0;
+    for (auto c : arg)
+    {
+        if (c == L'\\') { ++backslashes; continue; }
+        quoted.append(c == L'"' ? backslashes * 2 + 1 : backslashes, L'\\');
+        backslashes = 0;
+        quoted += c;
+    }
+    quoted.append(backslashes * 2, L'\\');
+    return quoted + L"\"";
+}
+
+bool Run(const vector<string>& command, const filesystem::path& workingDirectory, const filesystem::path& logPath, RunResult& outResult)
+{
+    wstring commandLine;
+    for (const auto& arg : command)
+    {
+        if (commandLine.empty() == false) commandLine += L' ';
+        commandLine += QuoteArgument(filesystem::u8path(arg).wstring());
+    }
+    SECURITY_ATTRIBUTES inheritable{ sizeof(SECURITY_ATTRIBUTES), nullptr, TRUE };
+    auto log = CreateFileW(logPath.wstring().c_str(), GENERIC_WRITE, FILE_SHARE_READ, &inheritable, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (log == INVALID_HANDLE_VALUE) return false;
+
+    STARTUPINFOW startup{};
+    startup.cb = sizeof(startup);
+    startup.dwFlags = STARTF_USESTDHANDLES;
+    startup.hStdInput = GetStdHandle(STD_INPUT_HANDLE);
+    startup.hStdOutput = log;
+    startup.hStdError = log;
+    PROCESS_INFORMATION process{};
+    const auto begin = chrono::steady_clock::now();
+    const auto created = CreateProcessW(nullptr, &commandLine[0], nullptr, nullptr, TRUE, 0, nullptr
+        , workingDirectory.wstring().c_str(), &startup, &process);
+    CloseHandle(log);
+    if (created == FALSE) return false;
+
+    WaitForSingleObject(process.hProcess, INFINITE);
+    outResult.seconds = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+    DWORD exitCode = 0;
+    GetExitCodeProcess(process.hProcess, &exitCode);
+    outResult.exitCode = static_cast<int>(exitCode);
+    PROCESS_MEMORY_COUNTERS memory{};
+    if (GetProcessMemoryInfo(process.hProcess, &memory, sizeof(memory))) outResult.peakMemory = memory.PeakWorkingSetSize;
+    IO_COUNTERS io{};
+    if (GetProcessIoCounters(process.hProcess, &io))
+    {
+        outResult.reads = io.ReadOperationCount;
+        outResult.writes = io.WriteOperationCount;
+        outResult.others = io.OtherOperationCount;
+    }
+    CloseHandle(process.hThread);
+    CloseHandle(process.hProcess);
+    return true;
+}
+#else
+bool Run(const vector<string>& command, const filesystem::path& workingDirectory, const filesystem::path& logPath, RunResult& outResult)
+{
+    vector<char*> argv;
+    for (const auto& arg : command) argv.push_back(const_cast<char*>(arg.c_str()));
+    argv.push_back(nullptr);
+    const auto& directory = workingDirectory.string();
+    const auto& log = logPath.string();
+
+    const auto begin = chrono::steady_clock::now();
+    const auto pid = fork(); // 자식에서는 async-signal-safe 호출만
+    if (pid < 0) return false;
+    if (pid == 0)
+    {
+        const auto fd = open(log.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0 || chdir(directory.c_str()) != 0) _exit(127);
+        dup2(fd, STDOUT_FILENO);
+        dup2(fd, STDERR_FILENO);
+        close(fd);
+        execv(argv[0], argv.data());
+        _exit(127);
+    }
+
+    int status = 0;
+    rusage usage{};
+    if (wait4(pid, &status, 0, &usage) != pid) return false;
+    outResult.seconds = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+    outResult.exitCode = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+    outResult.peakMemory = static_cast<uint64_t>(usage.ru_maxrss) * 1024; // linux 는 KB
+    outResult.reads = usage.ru_inblock;
+    outResult.writes = usage.ru_oublock;
+    outResult.others = usage.ru_nvcsw + usage.ru_nivcsw;
+    return true;
+}
+#endif
+
+// 가장 오래 걸린 phase 부터 ; 요청마다 기록되는 dns, connect, tls, ttfb 는 run 전체에 흩어져 있으므로 뺀다.
+string SummarizePhases(const filesystem::path& metricsPath)
+{
+    static const set<string> REQUEST_PHASES = { "dns", "connect", "tls", "ttfb" };
+    MetricsReport report;
+    const auto& json = ReadFile(metricsPath); // ParseContext 는 복사하지 않는다.
+    JS::ParseContext context(json);
+    if (context.parseTo(report) != JS::Error::NoError) return "(no metrics)";
+    auto& phases = report.Phases;
+    phases.erase(remove_if(phases.begin(), phases.end(), [](const MetricsPhase& p) { return REQUEST_PHASES.count(p.Name) > 0; }), phases.end());
+    sort(phases.begin(), phases.end(), [](const MetricsPhase& a, const MetricsPhase& b) { return a.Seconds > b.Seconds; });
+    stringstream summary;
+    summary << fixed << setprecision(3);
+    for (size_t i = 0; i < phases.size() && i < 4; ++i)
+    {
+        summary << (i ? ", " : "") << phases[i].Name << " " << phases[i].Seconds << "s";
+    }
+    return summary.str();
+}
+
+void PrintHeader()
+{
+#ifdef _WIN32
+    const char* ioNames[] = { "reads", "writes", "other io" };
+#else
+    const char* ioNames[] = { "blk in", "blk out", "ctx sw" };
+#endif
+    cout << left << setw(14) << "scenario" << setw(9) << "step" << right
+        << setw(9) << "wall s" << setw(10) << "net MB" << setw(9) << "MB/s" << setw(10) << "peak MB"
+        << setw(10) << ioNames[0] << setw(10) << ioNames[1] << setw(10) << ioNames[2] << setw(6) << "exit" << "  phases" << endl;
+}
+
+void PrintRow(const string& scenario, const string& step, const RunResult& result, uint64_t sentBytes, const string& phases)
+{
+    const auto mb = sentBytes / (1024.0 * 1024.0);
+    cout << left << setw(14) << scenario << setw(9) << step << right << fixed
+        << setprecision(3) << setw(9) << result.seconds
+        << setprecision(1) << setw(10) << mb << setw(9) << mb / result.seconds << setw(10) << result.peakMemory / (1024.0 * 1024.0)
+        << setw(10) << result.reads << setw(10) << result.writes << setw(10) << result.others << setw(6) << result.exitCode
+        << "  " << phases << endl;
+}
+
+int main(int argc, const char** argv)
+{
+    args::ArgumentParser parser("end-to-end patch benchmark with a local http server");
+    args::HelpFlag help(parser, "help", "Display this help menu", { 'h', "help" });
+    args::Positional<string> patcher(parser, "patcher", "path of the patcher executable to measure");
+    args::ValueFlag<size_t> latency(parser, "ms", "delay before each response (default 0)", { "latency" }, 0);
+    args::ValueFlag<size_t> bandwidth(parser, "KB/s", "bandwidth shared by all connections, 0 for unlimited (default 0)", { "bandwidth" }, 0);
+    args::ValueFlag<size_t> scale(parser, "%", "package size relative to the default (default 100)", { "scale" }, 100);
+    args::ValueFlag<size_t> repeat(parser, "N", "times to run every scenario (default 1)", { "repeat" }, 1);
+    args::ValueFlagList<string> only(parser, "name", "run only this scenario (repeatable)", { "scenario" });
+    args::ValueFlag<string> work(parser, "dir", "directory for packages and installs (default: temp)", { "work" });
+    args::PositionalList<string> patcherArgs(parser, "args", "passed to the patcher as is, after --");
+    args::Flag idle(parser, "idle", "exit at once ; used as the program the patcher launches", { "idle" });
+    try
+    {
+        parser.ParseCLI(argc, argv);
+    }
+    catch (const args::Help&)
+    {
+        cout << parser;
+        return 0;
+    }
+    catch (const args::ParseError& e)
+    {
+        cerr << e.what() << endl << parser;
+        return 1;
+    }
+    if (idle) return 0;
+    if (patcher == false)
+    {
+        cout << parser;
+        return 1;
+    }
+
+    const auto& patcherPath = filesystem::absolute(filesystem::u8path(patcher.Get()));
+    const auto& selfPath = filesystem::absolute(filesystem::u8path(argv[0]));
+    const auto& workPath = work ? filesystem::absolute(filesystem::u8path(work.Get())) : filesystem::temp_directory_path() / "patch_benchmark";
+    const auto percent = scale.Get();
+    const Scenario scenarios[] =
+    { // 많은 작은 파일 / 적은 큰 파일 x 압축 되는 / 안 되는 내용
+        { "small-text", 4000 * percent / 100, 8 * 1024, true },
+        { "small-random", 4000 * percent / 100, 8 * 1024, false },
+        { "large-text", 4, 32 * 1024 * 1024 * percent / 100, true },
+        { "large-random", 4, 32 * 1024 * 1024 * percent / 100, false },
+    };
+
+    const auto& wwwPath = workPath / "www";
+    ShapedServer server(wwwPath, chrono::milliseconds(latency.Get()), bandwidth.Get() * 1024);
+    if (server.Start() == false)
+    {
+        cerr << "could not start the server" << endl;
+        return 1;
+    }
+    cout << "server " << server.GetUrl("") << ", latency " << latency.Get() << "ms, bandwidth "
+        << (bandwidth.Get() ? to_string(bandwidth.Get()) + "KB/s" : string("unlimited")) << endl;
+
+    bool failed = false;
+    bool headerPrinted = false;
+    for (const auto& scenario : scenarios)
+    {
+        const auto& selected = args::get(only);
+        if (selected.empty() == false && find(selected.begin(), selected.end(), scenario.name) == selected.end()) continue;
+
+        // v1 은 전체 package, v2 는 manifest 로 바뀐 파일만
+        VersionInfo versions[2];
+        for (int v = 1; v <= 2; ++v)
+        {
+            const auto& version = to_string(v);
+            const auto& packagePath = wwwPath / scenario.name / version;
+            const auto& zipPath = packagePath / "package.zip";
+            const auto begin = chrono::steady_clock::now();
+            if (MakePackage(scenario, v, zipPath) == false)
+            {
+                cerr << "could not make " << zipPath.u8string() << endl;
+                return 1;
+            }
+            RunResult manifestRun;
+            if (Run({ patcherPath.string(), "--make-manifest", zipPath.string() }, packagePath, packagePath / "make-manifest.log", manifestRun) == false
+                || manifestRun.exitCode != 0)
+            {
+                cerr << "could not make the manifest of " << zipPath.u8string() << endl;
+                return 1;
+            }
+            const auto& prefix = string(scenario.name) + "/" + version + "/";
+
+            auto& info = versions[v - 1];
+            info.Version = version;
+            info.ZipFileUrl = server.GetUrl(prefix + "package.zip");
+            if (v > 1) info.ManifestUrl = server.GetUrl(prefix + "manifest.json");
+            info.ExecutePath = selfPath.u8string(); // 실행 단계까지 재도록 바로 끝나는 program
+            info.Arguments = { "--idle" };
+            cout << scenario.name << " v" << version << ": " << scenario.fileCount << " files, "
+                << filesystem::file_size(zipPath) / 1024 << "KB zip, made in " << fixed << setprecision(1)
+                << chrono::duration<double>(chrono::steady_clock::now() - begin).count() << "s" << endl;
+        }
+
+        struct Step
+        {
+            const char* name;
+            const VersionInfo& version;
+            bool redirect; // version file 을 같은 origin 의 redirect 로 받는다.
+        };
+        const Step steps[] = { { "install", versions[0], false }, { "update", versions[1], false }, { "current", versions[1], true } };
+        const auto& versionPath = string(scenario.name) + "/version.json";
+        const auto& installPath = workPath / "install" / scenario.name;
+        for (size_t r = 0; r < repeat.Get(); ++r)
+        {
+            error_code ec;
+            filesystem::remove_all(installPath, ec);
+            filesystem::create_directories(installPath, ec);
+            for (const auto& step : steps)
+            {
+                if (WriteFile(wwwPath / filesystem::u8path(versionPath), JS::serializeStruct(step.version)) == false)
+                {
+                    cerr << "could not write " << versionPath << endl;
+                    return 1;
+                }
+                server.TakeSentBytes();
+                bool reused = false;
+                server.TakeRedirect(reused);
+
+                const auto& versionUrl = server.GetUrl(step.redirect ? "redirect/" + versionPath : versionPath);
+                vector<string> command = { patcherPath.string(), versionUrl, "--metrics-out", "metrics.json" };
+                for (const auto& arg : args::get(patcherArgs)) command.push_back(arg);
+                RunResult result;
+                if (Run(command, installPath, installPath / (string(step.name) + ".log"), result) == false)
+                {
+                    cerr << "could not run " << patcherPath.u8string() << endl;
+                    return 1;
+                }
+                if (headerPrinted == false)
+                {
+                    PrintHeader();
+                    headerPrinted = true;
+                }
+                PrintRow(scenario.name, step.name, result, server.TakeSentBytes(), SummarizePhases(installPath / "metrics.json"));
+                if (result.exitCode != 0) failed = true;
+                if (step.redirect && (server.TakeRedirect(reused) == false || reused == false))
+                { // 같은 origin 의 redirect 는 keep-alive 연결을 다시 써야 한다.
+                    cerr << scenario.name << " " << step.name << ": the redirect was not followed on the same connection" << endl;
+                    failed = true;
+                }
+            }
+        }
+    }
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+// content-defined chunking (gear rolling hash, FastCDC 와 비슷)
+//   경계가 내용으로 정해지므로 앞쪽에 byte 가 끼어들거나 빠져도 뒤쪽 chunk 들은 그대로 남는다.
+//   배포하는 쪽과 받는 쪽이 같은 경계를 얻어야 하므로 상수와 gear table 을 바꾸면 안 된다.
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+const size_t CHUNK_MIN_SIZE = 16 * 1024;
+const size_t CHUNK_MAX_SIZE = 256 * 1024;
+const uint64_t CHUNK_MASK = 0xFFFF000000000000ull; // 경계 확률 2^-16 ; 평균 약 CHUNK_MIN_SIZE + 64KB
+
+namespace chunk_detail
+{
+    struct GearTable
+    {
+        uint64_t t[256];
+
+        GearTable()
+        { // splitmix64
+            uint64_t x = 0x9E3779B97F4A7C15ull;
+            for (auto& v : t)
+            {
+                x += 0x9E3779B97F4A7C15ull;
+                auto z = x;
+                z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+                z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+                v = z ^ (z >> 31);
+            }
+        }
+    };
+
+    inline const GearTable& GetGearTable()
+    {
+        static const GearTable table;
+        return table;
+    }
+}
+
+// data 앞에서 잘라낼 chunk 의 길이
+inline size_t GetChunkSize(const uint8_t* data, size_t size)
+{
+    if (size <= CHUNK_MIN_SIZE) return size;
+    const auto& gear = chunk_detail::GetGearTable().t;
+    const auto limit = std::min(size, CHUNK_MAX_SIZE);
+
+    uint64_t h = 0;
+    size_t i = CHUNK_MIN_SIZE - 64; // hash 는 마지막 64 byte 에만 영향을 받는다.
+    for (; i < CHUNK_MIN_SIZE; ++i) h = (h << 1) + gear[data[i]];
+    for (; i < limit; ++i)
+    {
+        h = (h << 1) + gear[data[i]];
+        if ((h & CHUNK_MASK) == 0) return i + 1;
+    }
+    return limit;
+}
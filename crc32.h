@@ -0,0 +1,253 @@
+#pragma once
+
+// CRC-32 (zip, png, zlib 와 같은 reflected 0xEDB88320)
+//   Crc32(0, data, size) 로 시작해 이전 결과를 crc 로 넘기면 이어서 계산한다.
+//   실행 중인 CPU 에 따라 PCLMULQDQ folding(x86), CRC32 명령(ARMv8), slice-by-16 중 가장 빠른 것을 고른다.
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define CRC32_X86 1
+#include <emmintrin.h>
+#include <smmintrin.h>
+#include <wmmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define CRC32_TARGET_PCLMUL
+#else
+#include <cpuid.h>
+#define CRC32_TARGET_PCLMUL __attribute__((target("pclmul,sse4.1")))
+#endif
+#endif
+
+#if defined(__ARM_FEATURE_CRC32)
+#define CRC32_ARM 1
+#include <arm_acle.h>
+#endif
+
+namespace crc32_detail
+{
+    struct Tables
+    {
+        uint32_t t[16][256];
+
+        Tables()
+        {
+            for (uint32_t i = 0; i < 256; ++i)
+            {
+                uint32_t c = i;
+                for (int k = 0; k < 8; ++k) c = (c >> 1) ^ (0xEDB88320u & (0u - (c & 1)));
+                t[0][i] = c;
+            }
+            for (uint32_t i = 0; i < 256; ++i)
+            {
+                for (int k = 1; k < 16; ++k) t[k][i] = (t[k - 1][i] >> 8) ^ t[0][t[k - 1][i] & 0xFF];
+            }
+        }
+    };
+
+    inline const Tables& GetTables()
+    {
+        static const Tables tables;
+        return tables;
+    }
+
+    inline uint32_t Load32(const uint8_t* p)
+    { // little endian
+        return static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8)
+            | (static_cast<uint32_t>(p[2]) << 16) | (static_cast<uint32_t>(p[3]) << 24);
+    }
+
+    // 아래 함수들은 반전된(~crc) 상태를 주고 받는다.
+    inline uint32_t Bytewise(uint32_t crc, const uint8_t* p, size_t size)
+    {
+        const auto& t = GetTables().t;
+        while (size--) crc = (crc >> 8) ^ t[0][(crc ^ *p++) & 0xFF];
+        return crc;
+    }
+
+    inline uint32_t Slice8(uint32_t crc, const uint8_t* p, size_t size)
+    {
+        const auto& t = GetTables().t;
+        for (; size >= 8; p += 8, size -= 8)
+        {
+            auto a = Load32(p) ^ crc;
+            auto b = Load32(p + 4);
+            crc = t[7][a & 0xFF] ^ t[6][(a >> 8) & 0xFF] ^ t[5][(a >> 16) & 0xFF] ^ t[4][a >> 24]
+                ^ t[3][b & 0xFF] ^ t[2][(b >> 8) & 0xFF] ^ t[1][(b >> 16) & 0xFF] ^ t[0][b >> 24];
+        }
+        return Bytewise(crc, p, size);
+    }
+
+    inline uint32_t Slice16(uint32_t crc, const uint8_t* p, size_t size)
+    {
+        const auto& t = GetTables().t;
+        for (; size >= 16; p += 16, size -= 16)
+        {
+            auto a = Load32(p) ^ crc;
+            auto b = Load32(p + 4);
+            auto c = Load32(p + 8);
+            auto d = Load32(p + 12);
+            crc = t[15][a & 0xFF] ^ t[14][(a >> 8) & 0xFF] ^ t[13][(a >> 16) & 0xFF] ^ t[12][a >> 24]
+                ^ t[11][b & 0xFF] ^ t[10][(b >> 8) & 0xFF] ^ t[9][(b >> 16) & 0xFF] ^ t[8][b >> 24]
+                ^ t[7][c & 0xFF] ^ t[6][(c >> 8) & 0xFF] ^ t[5][(c >> 16) & 0xFF] ^ t[4][c >> 24]
+                ^ t[3][d & 0xFF] ^ t[2][(d >> 8) & 0xFF] ^ t[1][(d >> 16) & 0xFF] ^ t[0][d >> 24];
+        }
+        return Bytewise(crc, p, size);
+    }
+
+#ifdef CRC32_X86
+    CRC32_TARGET_PCLMUL inline __m128i Fold(__m128i x, __m128i k, __m128i next)
+    {
+        auto lo = _mm_clmulepi64_si128(x, k, 0x00);
+        auto hi = _mm_clmulepi64_si128(x, k, 0x11);
+        return _mm_xor_si128(_mm_xor_si128(hi, next), lo);
+    }
+
+    // carry-less multiplication 으로 64 byte 씩 접는다.
+    // Intel, "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ Instruction" 의 reflected 상수
+    CRC32_TARGET_PCLMUL inline uint32_t Pclmul(uint32_t crc, const uint8_t* p, size_t size)
+    {
+        if (size < 64) return Slice16(crc, p, size);
+
+        alignas(16) static const uint64_t k1k2[] = { 0x0154442bd4, 0x01c6e41596 };
+        alignas(16) static const uint64_t k3k4[] = { 0x01751997d0, 0x00ccaa009e };
+        alignas(16) static const uint64_t k5k0[] = { 0x0163cd6124, 0x0000000000 };
+        alignas(16) static const uint64_t poly[] = { 0x01db710641, 0x01f7011641 };
+
+        auto x1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 0x00));
+        auto x2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 0x10));
+        auto x3 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 0x20));
+        auto x4 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 0x30));
+        x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(static_cast<int>(crc)));
+        auto x0 = _mm_load_si128(reinterpret_cast<const __m128i*>(k1k2));
+        p += 64;
+        size -= 64;
+
+        for (; size >= 64; p += 64, size -= 64)
+        { // 4 개의 128bit 를 나란히 접는다
+            auto x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+            auto x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+            auto x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+            auto x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+            x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+            x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+            x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+            x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+            x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 0x00)));
+            x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 0x10)));
+            x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 0x20)));
+            x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 0x30)));
+        }
+
+        // 128bit 하나로
+        x0 = _mm_load_si128(reinterpret_cast<const __m128i*>(k3k4));
+        x1 = Fold(x1, x0, x2);
+        x1 = Fold(x1, x0, x3);
+        x1 = Fold(x1, x0, x4);
+        for (; size >= 16; p += 16, size -= 16)
+        {
+            x1 = Fold(x1, x0, _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)));
+        }
+
+        // 64bit 로
+        x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+        x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+        x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+        x0 = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(k5k0));
+        x2 = _mm_srli_si128(x1, 4);
+        x1 = _mm_and_si128(x1, x3);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x1 = _mm_xor_si128(x1, x2);
+
+        // Barrett reduction 으로 32bit
+        x0 = _mm_load_si128(reinterpret_cast<const __m128i*>(poly));
+        x2 = _mm_and_si128(x1, x3);
+        x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+        x2 = _mm_and_si128(x2, x3);
+        x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+        x1 = _mm_xor_si128(x1, x2);
+        crc = static_cast<uint32_t>(_mm_extract_epi32(x1, 1));
+
+        return Slice16(crc, p, size);
+    }
+
+    inline bool HasPclmul()
+    { // CPUID.1:ECX - PCLMULQDQ(bit 1), SSE4.1(bit 19)
+        unsigned int ecx = 0;
+#ifdef _MSC_VER
+        int info[4] = {};
+        __cpuid(info, 1);
+        ecx = static_cast<unsigned int>(info[2]);
+#else
+        unsigned int eax, ebx, edx;
+        if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) == 0) return false;
+#endif
+        return (ecx & (1u << 1)) && (ecx & (1u << 19));
+    }
+#endif // CRC32_X86
+
+#ifdef CRC32_ARM
+    inline uint32_t Arm(uint32_t crc, const uint8_t* p, size_t size)
+    {
+        for (; size >= 8; p += 8, size -= 8)
+        {
+            uint64_t v;
+            memcpy(&v, p, sizeof(v));
+            crc = __crc32d(crc, v);
+        }
+        while (size--) crc = __crc32b(crc, *p++);
+        return crc;
+    }
+#endif // CRC32_ARM
+
+    using Function = uint32_t(*)(uint32_t, const uint8_t*, size_t);
+
+    struct Implementation
+    {
+        Function function;
+        const char* name;
+    };
+
+    inline Implementation Select()
+    {
+#ifdef CRC32_ARM
+        return { Arm, "armv8-crc32" };
+#else
+#ifdef CRC32_X86
+        if (HasPclmul()) return { Pclmul, "pclmulqdq" };
+#endif
+        return { Slice16, "slice-by-16" };
+#endif
+    }
+
+    inline const Implementation& GetImplementation()
+    {
+        static const Implementation implementation = Select();
+        return implementation;
+    }
+}
+
+inline uint32_t Crc32(uint32_t crc, const void* data, size_t size)
+{
+    const auto& implementation = crc32_detail::GetImplementation();
+    return ~implementation.function(~crc, static_cast<const uint8_t*>(data), size);
+}
+
+inline uint32_t Crc32Slice8(uint32_t crc, const void* data, size_t size)
+{
+    return ~crc32_detail::Slice8(~crc, static_cast<const uint8_t*>(data), size);
+}
+
+inline uint32_t Crc32Slice16(uint32_t crc, const void* data, size_t size)
+{
+    return ~crc32_detail::Slice16(~crc, static_cast<const uint8_t*>(data), size);
+}
+
+// Crc32() 가 사용하는 구현 이름 (log, benchmark 용)
+inline const char* GetCrc32ImplementationName()
+{
+    return crc32_detail::GetImplementation().name;
+}
@@ -0,0 +1,170 @@
+#pragma once
+
+// 파일 하나의 binary delta (VCDIFF 와 같은 COPY / ADD 명령열)
+//   MakeDelta(base, target) 로 만든 delta 와 base 로 ApplyDelta 하면 target 이 나온다.
+//
+//   format (little endian)
+//     "PDELTA01" | base size u64 | target size u64 | command ...
+//     command : DELTA_ADD  u8 | length u64 | bytes
+//               DELTA_COPY u8 | base offset u64 | length u64
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
+namespace delta_detail
+{
+    const char MAGIC[8] = { 'P', 'D', 'E', 'L', 'T', 'A', '0', '1' };
+    const uint8_t DELTA_ADD = 1;
+    const uint8_t DELTA_COPY = 2;
+    const size_t HEADER_SIZE = sizeof(MAGIC) + 8 + 8;
+
+    inline void Put64(std::vector<uint8_t>& out, uint64_t value)
+    {
+        for (int i = 0; i < 8; ++i) out.push_back(static_cast<uint8_t>(value >> (i * 8)));
+    }
+
+    inline uint64_t Get64(const uint8_t* p)
+    {
+        uint64_t value = 0;
+        for (int i = 7; i >= 0; --i) value = (value << 8) | p[i];
+        return value;
+    }
+
+    // base 를 block 단위로 색인해 두고 target 위로 rolling hash 를 굴려 일치하는 곳을 찾는다.
+    // block 이 작을수록 delta 가 작아지지만 색인이 커진다. (block 하나당 색인 하나)
+    inline size_t GetBlockSize(size_t baseSize)
+    {
+        size_t blockSize = 32;
+        while (baseSize / blockSize > (4u << 20)) blockSize *= 2;
+        return blockSize;
+    }
+
+    const uint32_t HASH_BASE = 0x01000193;
+
+    inline uint32_t Hash(const uint8_t* p, size_t size)
+    {
+        uint32_t h = 0;
+        for (size_t i = 0; i < size; ++i) h = h * HASH_BASE + p[i];
+        return h;
+    }
+}
+
+inline void MakeDelta(const uint8_t* base, size_t baseSize, const uint8_t* target, size_t targetSize, std::vector<uint8_t>& outDelta)
+{
+    using namespace delta_detail;
+
+    outDelta.clear();
+    outDelta.insert(outDelta.end(), MAGIC, MAGIC + sizeof(MAGIC));
+    Put64(outDelta, baseSize);
+    Put64(outDelta, targetSize);
+
+    size_t added = 0; // 아직 쓰지 않은 ADD 의 시작
+    auto flushAdd = [&](size_t end)
+    {
+        if (end <= added) return;
+        outDelta.push_back(DELTA_ADD);
+        Put64(outDelta, end - added);
+        outDelta.insert(outDelta.end(), target + added, target + end);
+    };
+
+    const auto blockSize = GetBlockSize(baseSize);
+    if (baseSize < blockSize || targetSize < blockSize)
+    {
+        flushAdd(targetSize);
+        return;
+    }
+
+    std::unordered_map<uint32_t, size_t> blocks; // hash -> base offset (처음 것)
+    blocks.reserve(baseSize / blockSize);
+    for (size_t offset = 0; offset + blockSize <= baseSize; offset += blockSize)
+    {
+        blocks.emplace(Hash(base + offset, blockSize), offset);
+    }
+
+    uint32_t power = 1; // HASH_BASE ^ (blockSize - 1)
+    for (size_t i = 1; i < blockSize; ++i) power *= HASH_BASE;
+
+    size_t position = 0;
+    auto h = Hash(target, blockSize);
+    while (position + blockSize <= targetSize)
+    {
+        auto found = blocks.find(h);
+        if (found != blocks.end() && memcmp(base + found->second, target + position, blockSize) == 0)
+        {
+            // 앞뒤로 늘린다. 앞쪽은 아직 ADD 로 쓰지 않은 곳까지만
+            auto baseBegin = found->second;
+            auto targetBegin = position;
+            while (targetBegin > added && baseBegin > 0 && base[baseBegin - 1] == target[targetBegin - 1])
+            {
+                --baseBegin;
+                --targetBegin;
+            }
+            auto length = position - targetBegin + blockSize;
+            while (targetBegin + length < targetSize && baseBegin + length < baseSize
+                && base[baseBegin + length] == target[targetBegin + length])
+            {
+                ++length;
+            }
+
+            flushAdd(targetBegin);
+            outDelta.push_back(DELTA_COPY);
+            Put64(outDelta, baseBegin);
+            Put64(outDelta, length);
+            added = position = targetBegin + length;
+            if (position + blockSize <= targetSize) h = Hash(target + position, blockSize);
+            continue;
+        }
+
+        if (position + blockSize == targetSize) break;
+        h = (h - target[position] * power) * HASH_BASE + target[position + blockSize];
+        ++position;
+    }
+    flushAdd(targetSize);
+}
+
+// delta 를 풀어 output 으로 보낸다. delta 가 깨졌거나 base 크기가 다르거나 output 이 false 면 false
+inline bool ApplyDelta(const uint8_t* base, size_t baseSize, const uint8_t* delta, size_t deltaSize
+    , const std::function<bool(const char*, size_t)>& output)
+{
+    using namespace delta_detail;
+
+    if (deltaSize < HEADER_SIZE || memcmp(delta, MAGIC, sizeof(MAGIC)) != 0) return false;
+    if (Get64(delta + sizeof(MAGIC)) != baseSize) return false;
+    const auto targetSize = Get64(delta + sizeof(MAGIC) + 8);
+
+    uint64_t written = 0;
+    size_t position = HEADER_SIZE;
+    while (position < deltaSize)
+    {
+        const auto command = delta[position++];
+        if (command == DELTA_ADD)
+        {
+            if (deltaSize - position < 8) return false;
+            const auto length = Get64(delta + position);
+            position += 8;
+            if (deltaSize - position < length) return false;
+            if (output(reinterpret_cast<const char*>(delta + position), static_cast<size_t>(length)) == false) return false;
+            position += static_cast<size_t>(length);
+            written += length;
+        }
+        else if (command == DELTA_COPY)
+        {
+            if (deltaSize - position < 16) return false;
+            const auto offset = Get64(delta + position);
+            const auto length = Get64(delta + position + 8);
+            position += 16;
+            if (offset > baseSize || baseSize - offset < length) return false;
+            if (output(reinterpret_cast<const char*>(base + offset), static_cast<size_t>(length)) == false) return false;
+            written += length;
+        }
+        else
+        {
+            return false;
+        }
+    }
+    return written == targetSize;
+}
@@ -0,0 +1,615 @@
+#pragma once
+
+// 빠른 raw DEFLATE (RFC 1951) decoder ; method 8 zip entry 를 miniz 의 tinfl 대신 푼다.
+//   64bit bit buffer 를 한 번 채우면 길이/거리 한 쌍(최대 48bit)을 다 읽을 수 있어 symbol 마다 입력을 확인하지 않는다.
+//   literal/length 표는 11bit 로 한 번에 찾고, 짧은 literal 두 개는 표의 한 칸에 함께 넣어 한 번의 조회로 내보낸다.
+//   입력 전체가 memory 에 있어야 한다. (mapping 된 zip, 한 번에 다 받은 entry)
+//
+//   InflateTo(input, size, output, capacity, written) : 출력 전체를 담을 buffer 에 바로 푼다.
+//   Inflate(input, size, output) : 32KB window 뒤에 INFLATE_FLUSH_SIZE 씩 모아 output 으로 넘긴다. 출력 크기와 상관없이 memory 가 일정하다.
+//     32KB 이상의 stored block 은 buffer 에 복사하지 않고 입력을 그대로 넘긴다. (압축되지 않는 내용)
+//   손상된 데이터면 false. tinfl 과 같은 stream 을 받아 같은 출력을 낸다.
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <vector>
+
+namespace inflate_detail
+{
+    const size_t WINDOW_SIZE = 32768;
+    const size_t MAX_MATCH = 258;
+    const size_t MIN_ROOM = MAX_MATCH + 8; // symbol 하나를 검사 없이 쓸 수 있는 출력 여유 ; 8 byte 씩 복사한다.
+    const size_t FLUSH_SIZE = 256 * 1024;
+    const size_t MAX_OVERREAD = 16; // 입력 끝 뒤의 0 을 이만큼 넘게 읽으면 잘린 stream
+
+    const int LITLEN_TABLE_BITS = 11;
+    const int DIST_TABLE_BITS = 8;
+    const int PRECODE_TABLE_BITS = 7;
+    const int MAX_CODE_BITS = 15;
+    // zlib 의 enough 로 구한 root + subtable 의 최대 크기 (288 symbols / 11bit, 32 symbols / 8bit)
+    const size_t LITLEN_TABLE_SIZE = 2342;
+    const size_t DIST_TABLE_SIZE = 402;
+    const size_t PRECODE_TABLE_SIZE = 1 << PRECODE_TABLE_BITS;
+
+    // 표의 한 칸 : bits 0-3 읽을 bit 수, 4-7 kind, 8-15 aux, 16-31 value
+    //   KIND_LITERAL, KIND_LITERAL2 : aux 첫 literal, value 둘째 literal ; kind 가 literal 수와 같다.
+    //   KIND_BASE : value 길이/거리 base, aux extra bit 수
+    //   KIND_SUBTABLE : value subtable 시작, aux subtable bit 수
+    const uint32_t KIND_INVALID = 0;
+    const uint32_t KIND_LITERAL = 1;
+    const uint32_t KIND_LITERAL2 = 2;
+    const uint32_t KIND_BASE = 3;
+    const uint32_t KIND_END = 4;
+    const uint32_t KIND_SUBTABLE = 5;
+
+    inline uint32_t MakeEntry(uint32_t kind, uint32_t aux, uint32_t value) { return (kind << 4) | (aux << 8) | (value << 16); }
+    inline uint32_t GetBits(uint32_t entry) { return entry & 0xF; }
+    inline uint32_t GetKind(uint32_t entry) { return (entry >> 4) & 0xF; }
+    inline uint32_t GetAux(uint32_t entry) { return (entry >> 8) & 0xFF; }
+    inline uint32_t GetValue(uint32_t entry) { return entry >> 16; }
+
+    const uint16_t LENGTH_BASE[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+    const uint8_t LENGTH_EXTRA[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+    const uint16_t DIST_BASE[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+    const uint8_t DIST_EXTRA[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+    const uint8_t PRECODE_ORDER[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+    inline uint32_t GetLitlenEntry(unsigned symbol)
+    {
+        if (symbol < 256) return MakeEntry(KIND_LITERAL, symbol, 0);
+        if (symbol == 256) return MakeEntry(KIND_END, 0, 0);
+        if (symbol < 286) return MakeEntry(KIND_BASE, LENGTH_EXTRA[symbol - 257], LENGTH_BASE[symbol - 257]);
+        return MakeEntry(KIND_INVALID, 0, 0); // 286, 287 은 fixed code 에만 있고 쓰이면 안 된다.
+    }
+
+    inline uint32_t GetDistEntry(unsigned symbol)
+    {
+        return symbol < 30 ? MakeEntry(KIND_BASE, DIST_EXTRA[symbol], DIST_BASE[symbol]) : MakeEntry(KIND_INVALID, 0, 0);
+    }
+
+    inline uint32_t GetPrecodeEntry(unsigned symbol)
+    {
+        return MakeEntry(KIND_BASE, 0, symbol);
+    }
+
+    inline uint32_t Reverse(uint32_t code, unsigned length)
+    {
+        uint32_t reversed = 0;
+        for (unsigned i = 0; i < length; ++i, code >>= 1) reversed = (reversed << 1) | (code & 1);
+        return reversed;
+    }
+
+    // code 길이들로 canonical huffman 표를 만든다. (zlib inflate_table 과 같은 root + subtable 구성)
+    // tinfl 처럼 넘치는 code 와, symbol 이 둘 이상인데 모자란 code 는 거부한다.
+    inline bool BuildTable(const uint8_t* lengths, unsigned count, uint32_t(*getEntry)(unsigned), int tableBits, uint32_t* table, size_t tableSize)
+    {
+        unsigned lengthCount[MAX_CODE_BITS + 1] = {};
+        for (unsigned s = 0; s < count; ++s) ++lengthCount[lengths[s]];
+        lengthCount[0] = 0;
+
+        int left = 1;
+        unsigned used = 0;
+        unsigned maxLength = 0;
+        for (unsigned length = 1; length <= MAX_CODE_BITS; ++length)
+        {
+            left = (left << 1) - static_cast<int>(lengthCount[length]);
+            if (left < 0) return false; // over-subscribed
+            used += lengthCount[length];
+            if (lengthCount[length]) maxLength = length;
+        }
+        if (left > 0 && used > 1) return false; // incomplete
+
+        const size_t rootSize = size_t(1) << tableBits;
+        std::fill(table, table + rootSize, MakeEntry(KIND_INVALID, 0, 0));
+        if (used == 0) return true; // 쓰이면 손상
+
+        // 길이, symbol 순으로 정렬 ; canonical code 는 이 순서로 1 씩 커진다.
+        unsigned offsets[MAX_CODE_BITS + 2] = {};
+        for (unsigned length = 1; length <= MAX_CODE_BITS; ++length) offsets[length + 1] = offsets[length] + lengthCount[length];
+        uint16_t sorted[288];
+        for (unsigned s = 0; s < count; ++s) if (lengths[s]) sorted[offsets[lengths[s]]++] = static_cast<uint16_t>(s);
+
+        unsigned remains[MAX_CODE_BITS + 1];
+        std::memcpy(remains, lengthCount, sizeof(remains));
+        uint32_t code = 0;
+        unsigned codeLength = lengths[sorted[0]];
+        size_t next = rootSize; // 다음 subtable 자리
+        uint32_t currentRoot = ~0u;
+        size_t subStart = 0;
+        unsigned subBits = 0;
+        for (unsigned i = 0; i < used; ++i)
+        {
+            const unsigned symbol = sorted[i];
+            const unsigned length = lengths[symbol];
+            code <<= length - codeLength;
+            codeLength = length;
+            const auto reversed = Reverse(code, length);
+            const auto entry = getEntry(symbol);
+            if (length <= static_cast<unsigned>(tableBits))
+            {
+                for (size_t k = reversed; k < rootSize; k += size_t(1) << length) table[k] = entry | length;
+            }
+            else
+            {
+                const auto root = reversed & (rootSize - 1);
+                if (root != currentRoot)
+                { // 이 root 를 공유하는 남은 code 들이 다 들어가는 가장 작은 subtable
+                    subBits = length - tableBits;
+                    int room = 1 << subBits;
+                    while (tableBits + subBits < maxLength)
+                    {
+                        room -= static_cast<int>(remains[tableBits + subBits]);
+                        if (room <= 0) break;
+                        ++subBits;
+                        room <<= 1;
+                    }
+                    if (next + (size_t(1) << subBits) > tableSize) return false;
+                    currentRoot = root;
+                    subStart = next;
+                    next += size_t(1) << subBits;
+                    std::fill(table + subStart, table + next, MakeEntry(KIND_INVALID, 0, 0)); // 하나뿐인 code 면 다 채워지지 않는다.
+                    table[root] = MakeEntry(KIND_SUBTABLE, subBits, static_cast<uint32_t>(subStart)) | tableBits;
+                }
+                const auto subLength = length - tableBits;
+                for (size_t k = reversed >> tableBits; k < (size_t(1) << subBits); k += size_t(1) << subLength) table[subStart + k] = entry | subLength;
+            }
+            --remains[length];
+            ++code;
+        }
+        return true;
+    }
+
+    // root 의 literal 뒤에 남은 bit 로 다음 literal 까지 정해지면 두 literal 을 한 칸에 넣는다.
+    inline void PairLiterals(uint32_t* table)
+    {
+        const size_t rootSize = size_t(1) << LITLEN_TABLE_BITS;
+        static_assert(LITLEN_TABLE_BITS <= 15, "4 bits for the length of a pair");
+        uint32_t single[size_t(1) << LITLEN_TABLE_BITS];
+        std::memcpy(single, table, sizeof(single));
+        for (size_t i = 0; i < rootSize; ++i)
+        {
+            const auto first = single[i];
+            if (GetKind(first) != KIND_LITERAL) continue;
+            const auto firstBits = GetBits(first);
+            const auto second = single[i >> firstBits];
+            if (GetKind(second) != KIND_LITERAL || firstBits + GetBits(second) > static_cast<uint32_t>(LITLEN_TABLE_BITS)) continue;
+            table[i] = MakeEntry(KIND_LITERAL2, GetAux(first), GetAux(second)) | (firstBits + GetBits(second));
+        }
+    }
+
+    struct FixedTables
+    {
+        uint32_t litlen[LITLEN_TABLE_SIZE];
+        uint32_t dist[DIST_TABLE_SIZE];
+
+        FixedTables()
+        {
+            uint8_t lengths[288];
+            std::memset(lengths, 8, 144);
+            std::memset(lengths + 144, 9, 112);
+            std::memset(lengths + 256, 7, 24);
+            std::memset(lengths + 280, 8, 8);
+            BuildTable(lengths, 288, GetLitlenEntry, LITLEN_TABLE_BITS, litlen, LITLEN_TABLE_SIZE);
+            PairLiterals(litlen);
+            std::memset(lengths, 5, 32);
+            BuildTable(lengths, 32, GetDistEntry, DIST_TABLE_BITS, dist, DIST_TABLE_SIZE);
+        }
+    };
+
+    inline const FixedTables& GetFixedTables()
+    {
+        static const FixedTables tables;
+        return tables;
+    }
+
+    class Decoder
+    {
+    public:
+        Decoder(const uint8_t* input, size_t size)
+            : in(input), inEnd(input + size)
+        {
+        }
+
+        // [outBegin, outEnd) 의 out 부터 푼다. outBegin 부터 out 까지는 이전 출력(거리 참조 가능)
+        // 자리가 MIN_ROOM 보다 모자라면 makeRoom(out) 을 부르고, 못 만들면 끝까지 확인하며 쓴다.
+        // stored block 의 내용은 입력에 그대로 있으므로 passStored(out, data, size, windowNeeded) 가 알아서 옮긴다.
+        // windowNeeded 가 false 면 뒤의 block 이 이 block 까지의 출력을 참조하지 않는다.
+        template<class MakeRoom, class PassStored>
+        bool Run(const uint8_t* outBegin, uint8_t*& out, uint8_t* outEnd, MakeRoom makeRoom, PassStored passStored)
+        {
+            for (bool final = false; final == false;)
+            {
+                if (Refill() == false) return false;
+                final = Take(1) != 0;
+                const auto type = Take(2);
+                if (type == 0)
+                {
+                    if (Stored(out, final, passStored) == false) return false;
+                    continue;
+                }
+                const uint32_t* litlen = nullptr;
+                const uint32_t* dist = nullptr;
+                if (type == 1)
+                {
+                    litlen = GetFixedTables().litlen;
+                    dist = GetFixedTables().dist;
+                }
+                else if (type == 2)
+                {
+                    if (ReadDynamicTables() == false) return false;
+                    litlen = dynamicLitlen;
+                    dist = dynamicDist;
+                }
+                else return false;
+                if (Huffman(litlen, dist, outBegin, out, outEnd, makeRoom) == false) return false;
+            }
+            // 입력 끝 뒤의 0 을 실제로 읽었다면 잘린 stream
+            return overread <= bitsLeft / 8;
+        }
+
+    private:
+        static uint64_t Load64(const uint8_t* p)
+        { // little endian
+            uint64_t value;
+            std::memcpy(&value, p, sizeof(value));
+            return value;
+        }
+
+        // 56bit 이상 채운다. 8 byte 이상 남았으면 한 번에 읽고 (넘친 bit 는 다음에 같은 값으로 다시 읽힌다), 끝 근처에서는 byte 씩, 끝 뒤로는 0 을 채운다.
+        bool Refill()
+        {
+            if (inEnd - in >= 8)
+            {
+                bitBuffer |= Load64(in) << bitsLeft;
+                in += (63 - bitsLeft) >> 3;
+                bitsLeft |= 56;
+                return true;
+            }
+            while (bitsLeft < 56)
+            {
+                if (in < inEnd) bitBuffer |= static_cast<uint64_t>(*in++) << bitsLeft;
+                else if (++overread > MAX_OVERREAD) return false;
+                bitsLeft += 8;
+            }
+            return true;
+        }
+
+        uint32_t Peek(unsigned count) const { return static_cast<uint32_t>(bitBuffer & ((uint64_t(1) << count) - 1)); }
+
+        void Drop(unsigned count)
+        {
+            bitBuffer >>= count;
+            bitsLeft -= count;
+        }
+
+        uint32_t Take(unsigned count)
+        {
+            const auto value = Peek(count);
+            Drop(count);
+            return value;
+        }
+
+        uint32_t Lookup(const uint32_t* table, int tableBits)
+        {
+            auto entry = table[Peek(tableBits)];
+            if (GetKind(entry) == KIND_SUBTABLE)
+            {
+                Drop(GetBits(entry));
+                entry = table[GetValue(entry) + Peek(GetAux(entry))];
+            }
+            Drop(GetBits(entry));
+            return entry;
+        }
+
+        bool ReadDynamicTables()
+        {
+            const unsigned litlenCount = Take(5) + 257;
+            const unsigned distCount = Take(5) + 1;
+            const unsigned precodeCount = Take(4) + 4;
+            if (litlenCount > 286 || distCount > 30) return false;
+
+            uint8_t precodeLengths[19] = {};
+            for (unsigned i = 0; i < precodeCount; ++i)
+            {
+                if (bitsLeft < 3 && Refill() == false) return false; // 모두 57bit 라 한 번에 다 채울 수 없다.
+                precodeLengths[PRECODE_ORDER[i]] = static_cast<uint8_t>(Take(3));
+            }
+            if (BuildTable(precodeLengths, 19, GetPrecodeEntry, PRECODE_TABLE_BITS, precode, PRECODE_TABLE_SIZE) == false) return false;
+
+            uint8_t lengths[286 + 30] = {};
+            for (unsigned i = 0; i < litlenCount + distCount;)
+            {
+                if (Refill() == false) return false;
+                const auto entry = Lookup(precode, PRECODE_TABLE_BITS);
+                if (GetKind(entry) != KIND_BASE) return false;
+                const auto symbol = GetValue(entry);
+                if (symbol < 16)
+                {
+                    lengths[i++] = static_cast<uint8_t>(symbol);
+                    continue;
+                }
+                uint8_t value = 0;
+                unsigned repeat = 0;
+                if (symbol == 16)
+                {
+                    if (i == 0) return false;
+                    value = lengths[i - 1];
+                    repeat = 3 + Take(2);
+                }
+                else if (symbol == 17) repeat = 3 + Take(3);
+                else repeat = 11 + Take(7);
+                if (i + repeat > litlenCount + distCount) return false;
+                std::memset(lengths + i, value, repeat);
+                i += repeat;
+            }
+            if (lengths[256] == 0) return false; // end of block 이 없다.
+            if (BuildTable(lengths, litlenCount, GetLitlenEntry, LITLEN_TABLE_BITS, dynamicLitlen, LITLEN_TABLE_SIZE) == false) return false;
+            PairLiterals(dynamicLitlen);
+            return BuildTable(lengths + litlenCount, distCount, GetDistEntry, DIST_TABLE_BITS, dynamicDist, DIST_TABLE_SIZE);
+        }
+
+        template<class PassStored>
+        bool Stored(uint8_t*& out, bool final, PassStored& passStored)
+        {
+            Drop(bitsLeft & 7);
+            if (Refill() == false) return false;
+            const auto length = Take(16);
+            if ((Take(16) ^ 0xFFFF) != length) return false;
+
+            // bit buffer 에 남은 byte 들을 입력으로 되돌린다.
+            const size_t buffered = bitsLeft / 8;
+            if (buffered < overread) return false;
+            in -= buffered - overread;
+            bitBuffer = 0;
+            bitsLeft = 0;
+            overread = 0;
+            if (static_cast<size_t>(inEnd - in) < length) return false;
+
+            const auto data = in;
+            in += length;
+            // 다음 block 이 window 크기 이상의 stored 면 (압축되지 않는 내용이 이어지면) 그 block 이 window 를 채운다.
+            // byte 경계에서 시작하므로 header 3bit 뒤 다음 byte 부터 LEN
+            const bool nextFillsWindow = inEnd - in >= 3 && ((in[0] >> 1) & 3) == 0 && static_cast<size_t>(in[1] | in[2] << 8) >= WINDOW_SIZE;
+            return passStored(out, data, static_cast<size_t>(length), final == false && nextFillsWindow == false);
+        }
+
+        static void WriteLiterals(uint8_t*& out, uint32_t entry, uint32_t kind)
+        { // 둘째 literal 은 한 개일 때도 쓰고 넘어간다. (다음 출력이 덮는다)
+            out[0] = static_cast<uint8_t>(GetAux(entry));
+            out[1] = static_cast<uint8_t>(GetValue(entry));
+            out += kind;
+        }
+
+        static bool IsLiteral(uint32_t kind) { return kind == KIND_LITERAL || kind == KIND_LITERAL2; }
+
+        // 출력에 length + 8 byte 여유가 있을 때
+        static void CopyMatch(uint8_t* out, size_t distance, size_t length)
+        {
+            const uint8_t* from = out - distance;
+            if (distance >= 8)
+            { // 8 byte 씩 ; 앞서 쓴 8 byte 를 다시 읽으므로 겹쳐도 맞다.
+                for (size_t i = 0; i < length; i += 8) std::memcpy(out + i, from + i, 8);
+            }
+            else if (distance == 1) std::memset(out, *from, length);
+            else
+            {
+                for (size_t i = 0; i < length; ++i) out[i] = from[i];
+            }
+        }
+
+        template<class MakeRoom>
+        bool Huffman(const uint32_t* litlen, const uint32_t* dist, const uint8_t* outBegin, uint8_t*& out, uint8_t* outEnd, MakeRoom& makeRoom)
+        {
+            const size_t FAST_ROOM = MIN_ROOM + 8; // literal 세 칸(6 byte) 뒤의 match 하나까지
+            for (;;)
+            {
+                // 입력과 출력이 넉넉한 동안은 symbol 마다 확인하지 않는다.
+                while (inEnd - in >= 8 && static_cast<size_t>(outEnd - out) >= FAST_ROOM)
+                {
+                    bitBuffer |= Load64(in) << bitsLeft;
+                    in += (63 - bitsLeft) >> 3;
+                    bitsLeft |= 56;
+
+                    auto entry = litlen[Peek(LITLEN_TABLE_BITS)];
+                    auto kind = GetKind(entry);
+                    if (IsLiteral(kind))
+                    { // root 의 literal 칸은 11bit 이하라 한 번 채운 56bit 로 세 칸까지 읽는다.
+                        Drop(GetBits(entry));
+                        WriteLiterals(out, entry, kind);
+                        entry = litlen[Peek(LITLEN_TABLE_BITS)];
+                        kind = GetKind(entry);
+                        if (IsLiteral(kind) == false) continue;
+                        Drop(GetBits(entry));
+                        WriteLiterals(out, entry, kind);
+                        entry = litlen[Peek(LITLEN_TABLE_BITS)];
+                        kind = GetKind(entry);
+                        if (IsLiteral(kind) == false) continue;
+                        Drop(GetBits(entry));
+                        WriteLiterals(out, entry, kind);
+                        continue;
+                    }
+                    if (kind == KIND_SUBTABLE)
+                    {
+                        Drop(GetBits(entry));
+                        entry = litlen[GetValue(entry) + Peek(GetAux(entry))];
+                        kind = GetKind(entry);
+                    }
+                    Drop(GetBits(entry));
+                    if (kind == KIND_LITERAL)
+                    {
+                        *out++ = static_cast<uint8_t>(GetAux(entry));
+                        continue;
+                    }
+                    if (kind == KIND_END) return true;
+                    if (kind != KIND_BASE) return false;
+
+                    const size_t length = GetValue(entry) + Take(GetAux(entry));
+                    entry = Lookup(dist, DIST_TABLE_BITS);
+                    if (GetKind(entry) != KIND_BASE) return false;
+                    const size_t distance = GetValue(entry) + Take(GetAux(entry));
+                    if (distance > static_cast<size_t>(out - outBegin)) return false;
+                    CopyMatch(out, distance, length);
+                    out += length;
+                }
+
+                // 끝 근처 ; symbol 하나씩 확인하며 쓴다.
+                if (Refill() == false) return false; // 이후 길이/거리 한 쌍까지 다시 채우지 않는다.
+                const bool roomy = static_cast<size_t>(outEnd - out) >= MIN_ROOM || (makeRoom(out) && static_cast<size_t>(outEnd - out) >= MIN_ROOM);
+                auto entry = Lookup(litlen, LITLEN_TABLE_BITS);
+                const auto kind = GetKind(entry);
+                if (IsLiteral(kind))
+                {
+                    if (roomy) WriteLiterals(out, entry, kind);
+                    else
+                    {
+                        if (static_cast<size_t>(outEnd - out) < kind) return false;
+                        out[0] = static_cast<uint8_t>(GetAux(entry));
+                        if (kind == KIND_LITERAL2) out[1] = static_cast<uint8_t>(GetValue(entry));
+                        out += kind;
+                    }
+                    continue;
+                }
+                if (kind == KIND_END) return true;
+                if (kind != KIND_BASE) return false;
+
+                const size_t length = GetValue(entry) + Take(GetAux(entry));
+                entry = Lookup(dist, DIST_TABLE_BITS);
+                if (GetKind(entry) != KIND_BASE) return false;
+                const size_t distance = GetValue(entry) + Take(GetAux(entry));
+                if (distance > static_cast<size_t>(out - outBegin)) return false;
+                if (roomy) CopyMatch(out, distance, length);
+                else
+                {
+                    if (static_cast<size_t>(outEnd - out) < length) return false;
+                    const uint8_t* from = out - distance;
+                    for (size_t i = 0; i < length; ++i) out[i] = from[i];
+                }
+                out += length;
+            }
+        }
+
+        const uint8_t* in;
+        const uint8_t* inEnd;
+        uint64_t bitBuffer = 0;
+        unsigned bitsLeft = 0;
+        size_t overread = 0;
+        uint32_t precode[PRECODE_TABLE_SIZE];
+        uint32_t dynamicLitlen[LITLEN_TABLE_SIZE];
+        uint32_t dynamicDist[DIST_TABLE_SIZE];
+    };
+}
+
+const size_t INFLATE_FLUSH_SIZE = inflate_detail::FLUSH_SIZE;
+
+// 출력 전체를 담을 buffer 에 바로 푼다. 손상되었거나 capacity 를 넘치면 false
+inline bool InflateTo(const void* input, size_t inputSize, void* output, size_t capacity, size_t& outWritten)
+{
+    auto decoder = std::make_unique<inflate_detail::Decoder>(static_cast<const uint8_t*>(input), inputSize);
+    auto begin = static_cast<uint8_t*>(output);
+    auto out = begin;
+    const auto end = begin + capacity;
+    const auto succeeded = decoder->Run(begin, out, end, [](uint8_t*&) { return false; },
+        [end](uint8_t*& at, const uint8_t* data, size_t size, bool)
+        {
+            if (static_cast<size_t>(end - at) < size) return false; // 출력이 넘친다.
+            std::memcpy(at, data, size);
+            at += size;
+            return true;
+        });
+    outWritten = static_cast<size_t>(out - begin);
+    return succeeded;
+}
+
+// 풀린 내용을 INFLATE_FLUSH_SIZE 안팎의 조각으로 output 에 넘긴다. 손상되었거나 output 이 false 를 주면 false
+inline bool Inflate(const void* input, size_t inputSize, const std::function<bool(const uint8_t* data, size_t size)>& output)
+{
+    using namespace inflate_detail;
+    auto decoder = std::make_unique<Decoder>(static_cast<const uint8_t*>(input), inputSize);
+    std::vector<uint8_t> buffer(WINDOW_SIZE + FLUSH_SIZE + MIN_ROOM);
+    const auto begin = buffer.data();
+    const auto end = begin + buffer.size();
+    uint8_t* flushed = begin; // 아직 output 으로 넘기지 않은 출력의 시작
+    bool outputFailed = false;
+    auto flush = [&](uint8_t*& out)
+    { // 넘긴 뒤 마지막 32KB 만 window 로 앞에 남긴다.
+        if (outputFailed || (out > flushed && output(flushed, static_cast<size_t>(out - flushed)) == false))
+        {
+            outputFailed = true;
+            return false;
+        }
+        const auto keep = std::min(WINDOW_SIZE, static_cast<size_t>(out - begin));
+        std::memmove(begin, out - keep, keep);
+        out = begin + keep;
+        flushed = out;
+        return true;
+    };
+    auto passStored = [&](uint8_t*& out, const uint8_t* data, size_t size, bool windowNeeded)
+    {
+        if (size < WINDOW_SIZE)
+        {
+            if (static_cast<size_t>(end - out) < size && flush(out) == false) return false; // flush 뒤에는 FLUSH_SIZE 넘게 빈다.
+            std::memcpy(out, data, size);
+            out += size;
+            return true;
+        }
+        // 큰 block 은 buffer 를 거치지 않고 입력에서 바로 넘긴다. window 가 필요하면 마지막 32KB 만 옮겨 둔다.
+        if (outputFailed || (out > flushed && output(flushed, static_cast<size_t>(out - flushed)) == false) || output(data, size) == false)
+        {
+            outputFailed = true;
+            return false;
+        }
+        out = begin;
+        if (windowNeeded)
+        {
+            std::memcpy(begin, data + size - WINDOW_SIZE, WINDOW_SIZE);
+            out += WINDOW_SIZE;
+        }
+        flushed = out;
+        return true;
+    };
+    auto out = begin;
+    if (decoder->Run(begin, out, end, flush, passStored) == false || outputFailed) return false;
+    return out == flushed || output(flushed, static_cast<size_t>(out - flushed));
+}
+
+enum class InflateBackend
+{
+    FAST, // 이 파일의 decoder
+    TINFL, // miniz 의 tinfl
+};
+
+inline InflateBackend& GetInflateBackendSetting()
+{
+    static InflateBackend backend = InflateBackend::FAST;
+    return backend;
+}
+
+// 시작할 때 한 번 고른다. (thread 들이 읽기 전에)
+inline void SetInflateBackend(InflateBackend backend)
+{
+    GetInflateBackendSetting() = backend;
+}
+
+inline InflateBackend GetInflateBackend()
+{
+    return GetInflateBackendSetting();
+}
+
+// zip_file.hpp 의 MINIZ_INFLATE_FUNC ; 1 성공, 0 실패, -1 이면 miniz 가 tinfl 로 푼다.
+// 출력 buffer 를 덮어쓸 뿐이므로 실패하면 tinfl 로 다시 풀어 본다.
+inline int InflateForMiniz(const void* input, size_t inputSize, void* output, size_t capacity, size_t* outWritten)
+{
+    if (GetInflateBackend() != InflateBackend::FAST) return -1;
+    return InflateTo(input, inputSize, output, capacity, *outWritten) ? 1 : -1;
+}
+
+// zip_file.hpp 의 MINIZ_INFLATE_STREAM_FUNC ; 이미 output 으로 넘긴 것이 있어 실패해도 tinfl 로 다시 풀 수 없다.
+inline int InflateStreamForMiniz(const void* input, size_t inputSize, const std::function<bool(const uint8_t* data, size_t size)>& output)
+{
+    if (GetInflateBackend() != InflateBackend::FAST) return -1;
+    return Inflate(input, inputSize, output) ? 1 : 0;
+}
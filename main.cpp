@@ -1,10 +1,34 @@
 ﻿#include <filesystem> // c++17 필요
+#include <thread>
+#include <atomic>
+#include <condition_variable>
+#include <set>
 
 #include "3rdparty/args.hxx"
 #define CPPHTTPLIB_OPENSSL_SUPPORT // https 사용
 #include "3rdparty/httplib.h"
+#include "crc32.h"
+#include "delta.h"
+#include "chunk.h"
+#include "inflate.h"
+#define MINIZ_CRC32_FUNC Crc32 // zip 검증에 빠른 CRC-32 사용
+#define MINIZ_INFLATE_FUNC InflateForMiniz // method 8 entry 는 빠른 decoder 로 ; tinfl 은 fallback
+#define MINIZ_INFLATE_STREAM_FUNC InflateStreamForMiniz
 #include "3rdparty/zip_file.hpp"
 #include "3rdparty/json_struct.h"
+#include <openssl/evp.h>
+
+#ifdef _WIN32
+#include <sddl.h>
+#include <shellapi.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <spawn.h>
+#include <fcntl.h>
+extern char** environ;
+#endif
 
 using namespace args;
 using namespace std;
@@ -22,6 +46,8 @@ string BuildHelpEpliog(const char* appName)
         << "        ; display this help document" << endl
         << "    " << appName << " https://drive.google.com/uc?export=download&id=1Yv0YNCYH539R0atZ8b0kxlCRSXampzxK" << endl
         << "        ; just patch and exit" << endl
+        << "    " << appName << " --launch-first https://example.com/version.json" << endl
+        << "        ; run the installed version at once, stage the update and apply it on next launch" << endl
         ;
 
     return epilog.str();
@@ -34,6 +60,25 @@ public:
         : parser("minimal patcher & runner by alkee", BuildHelpEpliog("patcher.exe"))
         , help(parser, "help", "Display this help menu", { 'h', "help" })
         , versionUrl(parser, "versionUrl", "url for version file")
+        , writeBuffer(parser, "KB", "download write buffer size in KB (default 1024)", { "write-buffer" }, 1024)
+        , connections(parser, "N", "parallel connections for package download (default 4)", { "connections" }, 4)
+        , noPipeline(parser, "no-pipeline", "extract the package after the download is finished", { "no-pipeline" })
+        , noIncremental(parser, "no-incremental", "rewrite every file when unpacking, even if it is already the same", { "no-incremental" })
+        , jobs(parser, "N", "threads for extracting the package (default: number of cores)", { 'j', "jobs" }, max(thread::hardware_concurrency(), 1u))
+        , makeManifest(parser, "zip", "write per-file manifest of the zip to manifest.json next to it, and exit", { "make-manifest" })
+        , deltaBase(parser, "zip", "with --make-manifest, write deltas from this previous package to delta/", { "delta-base" })
+        , deltaBaseVersion(parser, "version", "version of --delta-base package", { "delta-base-version" })
+        , deltaUrl(parser, "url", "url prefix where delta/ files will be published", { "delta-url" })
+        , chunkUrl(parser, "url", "with --make-manifest, write content-defined chunks to chunks/ and publish them under this url prefix", { "chunk-url" })
+        , verify(parser, "verify", "check installed files against the manifest of the installed version, and exit", { "verify" })
+        , repair(parser, "repair", "verify and fetch only the broken files, and exit", { "repair" })
+        , ioDepth(parser, "N", "concurrent file reads while verifying or prefetching (default 8, 1 for HDD)", { "io-depth" }, 8)
+        , launchFirst(parser, "launch-first", "run the installed version first and stage the update for the next launch", { "launch-first" })
+        , rollback(parser, "rollback", "undo the last update with the files kept in .previous, and exit", { "rollback" })
+        , wait(parser, "wait", "wait until the launched program exits and report how long it ran (not with --launch-first)", { "wait" })
+        , metricsOut(parser, "json", "write time, bytes and files of each phase to this file", { "metrics-out" })
+        , metricsTrace(parser, "json", "write the phases in chrome trace event format (about://tracing) to this file", { "metrics-trace" })
+        , tinfl(parser, "tinfl", "unpack deflated entries with miniz's tinfl instead of the fast decoder", { "tinfl" })
     {
         parser.ParseCLI(argc, argv);
     }
@@ -44,6 +89,25 @@ private:
 public:
     HelpFlag help;
     Positional<string> versionUrl;
+    ValueFlag<size_t> writeBuffer;
+    ValueFlag<size_t> connections;
+    Flag noPipeline;
+    Flag noIncremental;
+    ValueFlag<size_t> jobs;
+    ValueFlag<string> makeManifest;
+    ValueFlag<string> deltaBase;
+    ValueFlag<string> deltaBaseVersion;
+    ValueFlag<string> deltaUrl;
+    ValueFlag<string> chunkUrl;
+    Flag verify;
+    Flag repair;
+    ValueFlag<size_t> ioDepth;
+    Flag launchFirst;
+    Flag rollback;
+    Flag wait;
+    ValueFlag<string> metricsOut;
+    ValueFlag<string> metricsTrace;
+    Flag tinfl;
 
     const ArgumentParser& GetParser() { return parser; }
 };
@@ -62,7 +126,8 @@ bool LoadFrom(T& dest, const string& json)
 struct AppConfig
 {
     string VersionUrl;
-    JS_OBJ(VersionUrl);
+    bool LaunchFirst = false; // --launch-first
+    JS_OBJ(VersionUrl, LaunchFirst);
 
     bool Load(const string& configJson)
     {
@@ -77,6 +142,8 @@ enum class AppResult : int
     PARAMETER_ERROR = 1,
     FILESYSTEM_ERROR = 2,
     REQUEST_ERROR = 3,
+    VERIFY_ERROR = 4,
+    EXECUTE_ERROR = 5,
 
     VERSION_JOSN_ERROR = 11,
 };
@@ -127,7 +194,618 @@ void AddCookie(const string& headerValue, map<string, string>& outCookies)
     outCookies.insert({ key, value });
 }
 
-bool Request(const std::string& url, ostream& out, map<string, string> cookies = map<string, string>(), int recursiveCount = 0)
+void StoreCookies(const httplib::Response& res, map<string, string>& outCookies)
+{ // https://developer.mozilla.org/ko/docs/Web/HTTP/Cookies
+    const auto& COOKIE_KEY = "Set-Cookie";
+    auto cookieCount = res.get_header_value_count(COOKIE_KEY);
+    for (size_t i = 0; i < cookieCount; ++i)
+    {
+        AddCookie(res.get_header_value(COOKIE_KEY, i), outCookies);
+    }
+}
+
+bool IsHtml(const httplib::Response& res)
+{
+    return res.get_header_value("Content-Type").find("text/html") != string::npos;
+}
+
+string ToHex(const unsigned char* data, size_t size) // lower case
+{
+    const char* HEX = "0123456789abcdef";
+    string hex;
+    hex.reserve(size * 2);
+    for (size_t i = 0; i < size; ++i)
+    {
+        hex += HEX[data[i] >> 4];
+        hex += HEX[data[i] & 0xF];
+    }
+    return hex;
+}
+
+vector<unsigned char> FromHex(const string& hex)
+{
+    auto digit = [](char c) { return static_cast<unsigned char>(c <= '9' ? c - '0' : (c | 0x20) - 'a' + 10); };
+    vector<unsigned char> data(hex.size() / 2);
+    for (size_t i = 0; i < data.size(); ++i) data[i] = static_cast<unsigned char>((digit(hex[i * 2]) << 4) | digit(hex[i * 2 + 1]));
+    return data;
+}
+
+struct MetricsPhase
+{
+    string Name;
+    size_t Count = 0; // 기록된 구간의 수
+    double Seconds = 0; // 첫 구간의 시작부터 마지막 구간의 끝까지
+    double BusySeconds = 0; // 구간들의 합 ; 여러 thread 가 함께 했으면 Seconds 보다 길다.
+    uint64_t Bytes = 0;
+    uint64_t Files = 0;
+    double BytesPerSecond = 0; // Bytes / Seconds
+
+    JS_OBJ(Name, Count, Seconds, BusySeconds, Bytes, Files, BytesPerSecond);
+};
+
+struct MetricsReport
+{
+    double TotalSeconds = 0;
+    vector<MetricsPhase> Phases; // 처음 시작한 순서
+
+    JS_OBJ(TotalSeconds, Phases);
+};
+
+// Chrome trace event format (about://tracing, ui.perfetto.dev) ; 이름은 format 을 따른다.
+struct TraceEventArgs
+{
+    uint64_t bytes = 0;
+    uint64_t files = 0;
+
+    JS_OBJ(bytes, files);
+};
+
+struct TraceEvent
+{
+    string name;
+    string ph = "X"; // complete event
+    double ts = 0; // us
+    double dur = 0; // us
+    int pid = 1;
+    size_t tid = 0;
+    TraceEventArgs args;
+
+    JS_OBJ(name, ph, ts, dur, pid, tid, args);
+};
+
+struct TraceFile
+{
+    vector<TraceEvent> traceEvents;
+
+    JS_OBJ(traceEvents);
+};
+
+// 단계(phase)마다 걸린 시간과 처리한 byte, 파일 수를 모은다. 같은 이름의 구간은 report 에서 합친다.
+// 요청 하나의 연결 단계(dns, connect, tls, ttfb)는 RequestTimer 로 나누어 기록한다.
+class Metrics
+{
+public:
+    // scope 동안의 구간 하나
+    class Phase
+    {
+    public:
+        explicit Phase(const char* name)
+            : name(name), begin(chrono::steady_clock::now()) {}
+        ~Phase() { End(); }
+
+        Phase(const Phase&) = delete;
+        Phase& operator=(const Phase&) = delete;
+
+        void Add(uint64_t bytes, uint64_t files = 0)
+        {
+            this->bytes += bytes;
+            this->files += files;
+        }
+
+        void End()
+        {
+            if (ended) return;
+            ended = true;
+            GetInstance().Record(name, begin, chrono::steady_clock::now(), bytes, files);
+        }
+
+    private:
+        const char* name;
+        chrono::steady_clock::time_point begin;
+        uint64_t bytes = 0;
+        uint64_t files = 0;
+        bool ended = false;
+    };
+
+    static Metrics& GetInstance()
+    {
+        static Metrics metrics;
+        return metrics;
+    }
+
+    void Record(const string& name, chrono::steady_clock::time_point begin, chrono::steady_clock::time_point end, uint64_t bytes = 0, uint64_t files = 0)
+    {
+        lock_guard<mutex> lock(spanLock);
+        auto thread = threads.emplace(this_thread::get_id(), threads.size()).first->second;
+        spans.push_back({ name, begin, end, thread, bytes, files });
+    }
+
+    string SerializeReport()
+    {
+        MetricsReport report;
+        report.TotalSeconds = ToSeconds(chrono::steady_clock::now() - start);
+        map<string, size_t> indices;
+        vector<pair<chrono::steady_clock::time_point, chrono::steady_clock::time_point>> ranges;
+        lock_guard<mutex> lock(spanLock);
+        for (const auto& s : spans)
+        {
+            auto index = indices.emplace(s.Name, report.Phases.size());
+            if (index.second)
+            {
+                report.Phases.push_back(MetricsPhase());
+                report.Phases.back().Name = s.Name;
+                ranges.emplace_back(s.Begin, s.End);
+            }
+            auto& phase = report.Phases[index.first->second];
+            auto& range = ranges[index.first->second];
+            range.first = min(range.first, s.Begin);
+            range.second = max(range.second, s.End);
+            ++phase.Count;
+            phase.BusySeconds += ToSeconds(s.End - s.Begin);
+            phase.Bytes += s.Bytes;
+            phase.Files += s.Files;
+        }
+        for (size_t i = 0; i < report.Phases.size(); ++i)
+        {
+            auto& phase = report.Phases[i];
+            phase.Seconds = ToSeconds(ranges[i].second - ranges[i].first);
+            if (phase.Seconds > 0) phase.BytesPerSecond = phase.Bytes / phase.Seconds;
+        }
+        sort(report.Phases.begin(), report.Phases.end(), [&](const MetricsPhase& a, const MetricsPhase& b)
+        {
+            return ranges[indices[a.Name]].first < ranges[indices[b.Name]].first;
+        });
+        return JS::serializeStruct(report);
+    }
+
+    string SerializeTrace()
+    {
+        TraceFile trace;
+        lock_guard<mutex> lock(spanLock);
+        for (const auto& s : spans)
+        {
+            TraceEvent e;
+            e.name = s.Name;
+            e.ts = ToSeconds(s.Begin - start) * 1e6;
+            e.dur = ToSeconds(s.End - s.Begin) * 1e6;
+            e.tid = s.Thread;
+            e.args.bytes = s.Bytes;
+            e.args.files = s.Files;
+            trace.traceEvents.push_back(move(e));
+        }
+        return JS::serializeStruct(trace);
+    }
+
+private:
+    struct Span
+    {
+        string Name;
+        chrono::steady_clock::time_point Begin;
+        chrono::steady_clock::time_point End;
+        size_t Thread;
+        uint64_t Bytes;
+        uint64_t Files;
+    };
+
+    static double ToSeconds(chrono::steady_clock::duration duration)
+    {
+        return chrono::duration<double>(duration).count();
+    }
+
+    const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    mutex spanLock;
+    vector<Span> spans;
+    map<thread::id, size_t> threads; // trace 의 tid 는 처음 기록한 순서
+};
+
+// 요청 하나를 연결 단계로 나눈다. httplib 이 요청하는 thread 에서 부르는 callback 들로 시각을 찍는다.
+//   dns     요청 ~ socket 생성 (새 연결만 ; httplib 은 이름을 찾은 뒤 socket 을 만든다)
+//   connect socket 생성 ~ TLS 시작 (https 의 새 연결만)
+//   tls     TLS 시작 ~ handshake 끝
+//   ttfb    마지막 단계 ~ 첫 응답 ; http 의 새 연결은 TCP 연결을 포함한다.
+class RequestTimer
+{
+public:
+    static void Begin()
+    {
+        Get() = Marks();
+        Get().Begin = chrono::steady_clock::now();
+    }
+    static void MarkSocket() { Get().Socket = chrono::steady_clock::now(); }
+    static void MarkTlsStart() { Get().TlsStart = chrono::steady_clock::now(); }
+    static void MarkTlsDone() { Get().TlsDone = chrono::steady_clock::now(); }
+
+    // 첫 응답을 받았을 때
+    static void End()
+    {
+        auto& marks = Get();
+        auto& metrics = Metrics::GetInstance();
+        const auto now = chrono::steady_clock::now();
+        const chrono::steady_clock::time_point none;
+        auto last = marks.Begin;
+        auto record = [&](const char* name, chrono::steady_clock::time_point at)
+        {
+            if (at == none || at < last) return;
+            metrics.Record(name, last, at);
+            last = at;
+        };
+        record("dns", marks.Socket);
+        record("connect", marks.TlsStart);
+        record("tls", marks.TlsDone);
+        record("ttfb", now);
+        marks = Marks();
+    }
+
+private:
+    struct Marks
+    {
+        chrono::steady_clock::time_point Begin;
+        chrono::steady_clock::time_point Socket;
+        chrono::steady_clock::time_point TlsStart;
+        chrono::steady_clock::time_point TlsDone;
+    };
+
+    static Marks& Get()
+    {
+        thread_local Marks marks;
+        return marks;
+    }
+};
+
+struct TlsSessionEntry
+{
+    string Address; // host:port
+    string Session; // DER, hex
+
+    JS_OBJ(Address, Session);
+};
+
+struct TlsSessionFile
+{
+    vector<TlsSessionEntry> Sessions;
+
+    JS_OBJ(Sessions);
+};
+
+// host:port 마다 마지막 TLS session 을 기억해 두었다가 다음 연결에서 이어 쓴다. (session resumption ; handshake 의 왕복이 준다)
+// 파일로 저장해 다음 실행의 첫 연결(version 확인)도 이어 쓸 수 있게 한다.
+// session 에는 비밀 값이 들어 있으므로 파일은 소유자만 읽을 수 있게 만들고 다른 곳으로 옮기지 않는다.
+class TlsSessionCache
+{
+public:
+    static TlsSessionCache& GetInstance()
+    {
+        static TlsSessionCache cache;
+        return cache;
+    }
+
+    ~TlsSessionCache()
+    {
+        for (auto& s : sessions) SSL_SESSION_free(s.second);
+    }
+
+    // 만료된 session 은 버린다.
+    bool Load(const string& json)
+    {
+        TlsSessionFile file;
+        if (LoadFrom(file, json) == false) return false;
+
+        const auto now = time(nullptr);
+        lock_guard<mutex> lock(sessionLock);
+        for (const auto& entry : file.Sessions)
+        {
+            const auto& der = FromHex(entry.Session);
+            const unsigned char* p = der.data();
+            auto session = d2i_SSL_SESSION(nullptr, &p, static_cast<long>(der.size()));
+            if (session == nullptr) continue;
+            if (SSL_SESSION_is_resumable(session) == 0 || SSL_SESSION_get_time(session) + SSL_SESSION_get_timeout(session) < now)
+            {
+                SSL_SESSION_free(session);
+                continue;
+            }
+            Store(entry.Address, session);
+        }
+        changed = false;
+        return true;
+    }
+
+    // 마지막 Load, Serialize 뒤로 새 session 이 있는지
+    bool IsChanged()
+    {
+        lock_guard<mutex> lock(sessionLock);
+        return changed;
+    }
+
+    string Serialize()
+    {
+        TlsSessionFile file;
+        lock_guard<mutex> lock(sessionLock);
+        for (const auto& s : sessions)
+        {
+            vector<unsigned char> der(static_cast<size_t>(max(i2d_SSL_SESSION(s.second, nullptr), 0)));
+            auto p = der.data();
+            if (der.empty() || i2d_SSL_SESSION(s.second, &p) <= 0) continue;
+            file.Sessions.push_back({ s.first, ToHex(der.data(), der.size()) });
+        }
+        changed = false;
+        return JS::serializeStruct(file);
+    }
+
+    // https client(origin 은 scheme://host[:port])의 연결이 기억한 session 을 이어 쓰고 새 session 을 기억하게 한다.
+    void Attach(httplib::Client& client, const string& origin)
+    {
+        auto context = client.ssl_context();
+        if (context == nullptr) return; // http
+        SSL_CTX_set_session_cache_mode(context, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+        SSL_CTX_sess_set_new_cb(context, OnNewSession);
+        SSL_CTX_set_info_callback(context, OnInfo);
+        const string* address;
+        {
+            lock_guard<mutex> lock(sessionLock);
+            address = &*addresses.insert(GetAddress(origin)).first; // set 의 원소는 옮겨지지 않는다.
+        }
+        client.set_ssl_setup([this, address](SSL* ssl)
+        {
+            RequestTimer::MarkTlsStart();
+            SSL_set_ex_data(ssl, GetAddressIndex(), const_cast<string*>(address)); // 새 session 을 받을 때 쓴다.
+            lock_guard<mutex> lock(sessionLock);
+            auto found = sessions.find(*address);
+            if (found != sessions.end()) SSL_set_session(ssl, found->second);
+        });
+    }
+
+    void PrintStatistics() const
+    {
+        if (resumedHandshakes + fullHandshakes == 0) return;
+        cout << "tls : " << resumedHandshakes << " resumed, " << fullHandshakes << " full handshakes" << endl;
+    }
+
+private:
+    // origin 의 host:port ; port 가 없으면 https 의 443
+    static string GetAddress(const string& origin)
+    {
+        const auto schemeEnd = origin.find("://");
+        auto address = origin.substr(schemeEnd == string::npos ? 0 : schemeEnd + 3);
+        const auto portPos = address.rfind(':');
+        if (portPos == string::npos || address.find(']', portPos) != string::npos) address += ":443"; // [IPv6] 안의 ':' 는 port 가 아니다.
+        return address;
+    }
+
+    // SSL 마다 붙여 두는 값들 ; 연결의 host:port, handshake 를 이미 셌는지
+    static int GetAddressIndex()
+    {
+        static const int index = SSL_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr);
+        return index;
+    }
+    static int GetHandshakeIndex()
+    {
+        static const int index = SSL_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr);
+        return index;
+    }
+
+    // session 의 소유권을 가져간다.
+    void Store(const string& address, SSL_SESSION* session)
+    {
+        auto& stored = sessions[address];
+        if (stored) SSL_SESSION_free(stored);
+        stored = session;
+        changed = true;
+    }
+
+    static int OnNewSession(SSL* ssl, SSL_SESSION* session)
+    {
+        const auto address = static_cast<const string*>(SSL_get_ex_data(ssl, GetAddressIndex()));
+        if (address == nullptr) return 0;
+        auto& cache = GetInstance();
+        lock_guard<mutex> lock(cache.sessionLock);
+        cache.Store(*address, session);
+        return 1; // session 을 가져갔다.
+    }
+
+    static void OnInfo(const SSL* ssl, int where, int)
+    {
+        if ((where & SSL_CB_HANDSHAKE_DONE) == 0) return;
+        // TLS 1.3 의 NewSessionTicket, key update 를 받을 때도 다시 불린다. 연결마다 처음 한 번만 센다.
+        auto connection = const_cast<SSL*>(ssl);
+        if (SSL_get_ex_data(connection, GetHandshakeIndex())) return;
+        SSL_set_ex_data(connection, GetHandshakeIndex(), connection);
+        RequestTimer::MarkTlsDone();
+        auto& cache = GetInstance();
+        if (SSL_session_reused(connection)) ++cache.resumedHandshakes;
+        else ++cache.fullHandshakes;
+    }
+
+    mutex sessionLock;
+    map<string, SSL_SESSION*> sessions; // host:port 마다
+    set<string> addresses; // Attach 한 연결들의 host:port
+    bool changed = false;
+    atomic<size_t> resumedHandshakes{ 0 };
+    atomic<size_t> fullHandshakes{ 0 };
+};
+
+// origin(scheme://host:port) 마다 keep-alive 연결을 모아 두고 다시 쓴다.
+// 연결 하나는 한 번에 한 thread 만 쓰도록 빌려주고(Lease) 돌려받는다.
+// 새로 맺은 연결과 다시 쓴 연결의 첫 응답까지 시간을 비교해 아낀 handshake 시간을 어림한다.
+class ClientPool
+{
+public:
+    class Lease
+    {
+    public:
+        Lease() = default;
+        Lease(ClientPool* pool, string origin, unique_ptr<httplib::Client> client)
+            : pool(pool), origin(move(origin)), client(move(client)) {}
+        Lease(Lease&&) = default;
+        Lease& operator=(Lease&& other)
+        { // 쥐고 있던 연결은 닫지 않고 pool 로 돌려준다. (client = ClientPool::Lease() 로 일찍 돌려줄 수 있다)
+            if (this == &other) return *this;
+            if (pool && client) pool->Release(origin, move(client));
+            pool = other.pool;
+            origin = move(other.origin);
+            client = move(other.client);
+            return *this;
+        }
+        ~Lease() { if (pool && client) pool->Release(origin, move(client)); }
+
+        httplib::Client* Get() const { return client.get(); }
+        httplib::Client* operator->() const { return client.get(); }
+        httplib::Client& operator*() const { return *client; }
+
+    private:
+        ClientPool* pool = nullptr;
+        string origin;
+        unique_ptr<httplib::Client> client;
+    };
+
+    static ClientPool& GetInstance()
+    {
+        static ClientPool pool;
+        return pool;
+    }
+
+    Lease Acquire(const string& origin)
+    {
+        {
+            lock_guard<mutex> lock(poolLock);
+            auto& clients = idle[origin];
+            if (clients.empty() == false)
+            {
+                auto client = move(clients.back());
+                clients.pop_back();
+                return Lease(this, origin, move(client));
+            }
+        }
+        auto client = make_unique<httplib::Client>(origin.c_str());
+        client->set_keep_alive(true);
+        client->set_socket_options([this](socket_t)
+        {
+            ++connections;
+            RequestTimer::MarkSocket();
+        });
+        TlsSessionCache::GetInstance().Attach(*client, origin);
+        return Lease(this, origin, move(client));
+    }
+
+    // 요청의 response handler 를 감싸 요청부터 첫 응답까지의 시간을 연결을 새로 맺었는지에 따라 기록한다.
+    httplib::ResponseHandler Measure(const httplib::Client& client, httplib::ResponseHandler handler = nullptr)
+    {
+        const bool reused = client.is_socket_open() > 0;
+        const auto begin = chrono::steady_clock::now();
+        RequestTimer::Begin();
+        auto measured = make_shared<bool>(false);
+        return [this, reused, begin, measured, handler](const httplib::Response& response)
+        {
+            if (*measured == false)
+            {
+                *measured = true;
+                Record(reused, chrono::steady_clock::now() - begin);
+                RequestTimer::End();
+            }
+            return handler ? handler(response) : true;
+        };
+    }
+
+    // send 로 요청을 한 번 보낸다. send 는 받은 response handler(Measure 로 감싼 handler)를 요청에 넘긴다.
+    // 다시 쓴 연결은 쉬는 동안 서버가 닫았을 수 있다. 응답을 받기 전에 실패했으면 새로 연결해 한 번 더 보낸다.
+    httplib::Result Send(const httplib::Client& client, const function<httplib::Result(httplib::ResponseHandler)>& send
+        , httplib::ResponseHandler handler = nullptr)
+    {
+        bool responded = false;
+        auto respond = [&](const httplib::Response& response)
+        {
+            responded = true;
+            return handler ? handler(response) : true;
+        };
+        const bool reused = client.is_socket_open() > 0;
+        auto res = send(Measure(client, respond));
+        if (reused && responded == false && res.error() != httplib::Error::Success && res.error() != httplib::Error::Canceled)
+        { // 쉬는 동안 서버가 닫은 연결 ; 새로 연결해 한 번 더
+            res = send(Measure(client, respond));
+        }
+        return res;
+    }
+
+    void PrintStatistics()
+    {
+        lock_guard<mutex> lock(poolLock);
+        const auto requests = freshRequests + reusedRequests;
+        if (requests == 0) return;
+        cout << "connections : " << connections << " opened for " << requests << " requests, " << reusedRequests << " reused";
+        if (freshRequests > 0 && reusedRequests > 0)
+        {
+            const auto freshAverage = freshSeconds / freshRequests * 1000;
+            const auto reusedAverage = reusedSeconds / reusedRequests * 1000;
+            const auto handshake = max(freshAverage - reusedAverage, 0.0);
+            cout << " ; first response " << freshAverage << " ms on new, " << reusedAverage << " ms on reused connections"
+                << ", about " << handshake * reusedRequests << " ms of handshakes saved";
+        }
+        cout << endl;
+    }
+
+private:
+    const size_t MAX_IDLE_PER_ORIGIN = 16;
+
+    void Release(const string& origin, unique_ptr<httplib::Client> client)
+    {
+        lock_guard<mutex> lock(poolLock);
+        auto& clients = idle[origin];
+        if (clients.size() < MAX_IDLE_PER_ORIGIN) clients.push_back(move(client));
+    }
+
+    void Record(bool reused, chrono::duration<double> elapsed)
+    {
+        lock_guard<mutex> lock(poolLock);
+        if (reused)
+        {
+            ++reusedRequests;
+            reusedSeconds += elapsed.count();
+        }
+        else
+        {
+            ++freshRequests;
+            freshSeconds += elapsed.count();
+        }
+    }
+
+    mutex poolLock;
+    map<string, vector<unique_ptr<httplib::Client>>> idle;
+    atomic<size_t> connections{ 0 };
+    size_t freshRequests = 0;
+    size_t reusedRequests = 0;
+    double freshSeconds = 0;
+    double reusedSeconds = 0;
+};
+
+// 조건부 요청(If-None-Match, If-Modified-Since) 에 쓸 지난 응답의 validator
+struct CacheValidator
+{
+    string Url;
+    string ETag;
+    string LastModified;
+    bool NotModified = false; // 304 응답 ; 저장하지 않는다.
+
+    JS_OBJ(Url, ETag, LastModified);
+
+    bool Load(const string& json)
+    {
+        return LoadFrom(*this, json);
+    }
+};
+
+// validator 가 있으면 조건부로 요청한다. 304 면 아무것도 쓰지 않고 validator->NotModified,
+// 200 이면 응답의 ETag, Last-Modified 를 validator 에 기록한다.
+bool Request(const std::string& url, ostream& out, map<string, string> cookies = map<string, string>(), int recursiveCount = 0
+    , CacheValidator* validator = nullptr)
 {
     ++recursiveCount;
     if (recursiveCount > 5)
@@ -139,6 +817,7 @@ bool Request(const std::string& url, ostream& out, map<string, string> cookies =
     auto sepPos = GetPathSepIndex(url);
     auto serverAddress = url.substr(0, sepPos);
     auto path = url.substr(sepPos);
+    const bool googleDrive = url.find("://drive.google.com/") < 6;
 
     // preparing request header
     auto headers = httplib::Headers();
@@ -146,23 +825,53 @@ bool Request(const std::string& url, ostream& out, map<string, string> cookies =
     { // https://developer.mozilla.org/ko/docs/Web/HTTP/Cookies
         headers.insert({ "Cookie", MakeCookieValue(cookies) });
     }
+    if (validator)
+    { // https://developer.mozilla.org/en-US/docs/Web/HTTP/Conditional_requests
+        if (validator->ETag.empty() == false) headers.insert({ "If-None-Match", validator->ETag });
+        if (validator->LastModified.empty() == false) headers.insert({ "If-Modified-Since", validator->LastModified });
+    }
 
     // requesting - GET
-    httplib::Client versionClient(serverAddress.c_str());
-    auto res = versionClient.Get(path.c_str(), headers);
+    //   200 OK 응답의 body 는 받는 즉시 out 으로 흘려보내 전체 파일을 메모리에 들고 있지 않는다.
+    //   redirection, error, google drive 확인 페이지(html) 등 작은 body 만 memory 에 모은다.
+    //   같은 origin 의 연결(redirect, google drive 확인 링크 등)은 다시 쓴다.
+    bool streaming = false;
+    string body;
+    auto& pool = ClientPool::GetInstance();
+    auto client = pool.Acquire(serverAddress);
+    auto res = pool.Send(*client, [&](httplib::ResponseHandler handler)
+    {
+        return client->Get(path.c_str(), headers, handler,
+            [&](const char* data, size_t length)
+            {
+                if (streaming == false)
+                {
+                    body.append(data, length);
+                    return true;
+                }
+                out.write(data, static_cast<streamsize>(length));
+                return out.good();
+            });
+    },
+    [&](const httplib::Response& response)
+    {
+        streaming = response.status == 200 && (googleDrive == false || IsHtml(response) == false);
+        return true;
+    });
+    if (res.error() == httplib::Error::Canceled && out.good() == false)
+    {
+        cerr << "could not write response : " << url << endl;
+        return false;
+    }
     if (res.error() != httplib::Error::Success)
     {
         cerr << "http client error(" << res.error() << ") : " << url << endl;
         return false;
     }
+    client = ClientPool::Lease(); // 응답은 다 받았다. redirect, 확인 링크가 같은 연결을 쓰도록 먼저 돌려준다.
 
-    // storing cookies ; https://developer.mozilla.org/ko/docs/Web/HTTP/Cookies
-    const auto& COOKIE_KEY = "Set-Cookie";
-    auto cookieCount = res->get_header_value_count(COOKIE_KEY);
-    for (size_t i = 0; i < cookieCount; ++i)
-    {
-        AddCookie(res->get_header_value(COOKIE_KEY, i), cookies);
-    }
+    // storing cookies
+    StoreCookies(res.value(), cookies);
 
     // debug output(header)
     //cout << "STATUS(" << res->status << ") " << url << endl;
@@ -171,30 +880,40 @@ bool Request(const std::string& url, ostream& out, map<string, string> cookies =
     //{
     //    cout << "    " << i->first << " = " << i->second << endl;
     //}
-    //cout << "body = " << res->body << endl << endl;
+    //cout << "body = " << body << endl << endl;
 
     // result handling
+    if (res->status == 304 && validator) // Not Modified
+    {
+        validator->NotModified = true;
+        return true;
+    }
+
     if (res->status == 200) // OK
     {
+        if (validator && (streaming || IsHtml(res.value()) == false))
+        {
+            validator->ETag = res->get_header_value("ETag");
+            validator->LastModified = res->get_header_value("Last-Modified");
+        }
+        if (streaming) return true; // already written
+
         // google-drive-specific ; 대용량 파일의 경우 virus 검사 할 수 없다며 별도의 링크를 요구
-        if (url.find("://drive.google.com/") < 6)
+        auto hrefPos = body.find("href=\"/uc?export=download&amp;confirm=");
+        if (hrefPos != string::npos)
         {
-            auto hrefPos = res->body.find("href=\"/uc?export=download&amp;confirm=");
-            if (hrefPos != string::npos)
-            {
-                auto hrefEndPos = res->body.find('"', hrefPos + 6);
-                auto link = res->body.substr(hrefPos + 6, hrefEndPos - (hrefPos + 6));
-                link = Replace(link, "&amp;", "&");
-                auto schemePos = link.find_first_not_of("://");
-                auto fullLinkUrl = (schemePos == 4 /*http*/ || schemePos == 5 /*https*/)
-                    ? link
-                    : serverAddress + link;
+            auto hrefEndPos = body.find('"', hrefPos + 6);
+            auto link = body.substr(hrefPos + 6, hrefEndPos - (hrefPos + 6));
+            link = Replace(link, "&amp;", "&");
+            auto schemePos = link.find_first_not_of("://");
+            auto fullLinkUrl = (schemePos == 4 /*http*/ || schemePos == 5 /*https*/)
+                ? link
+                : serverAddress + link;
 
-                return Request(fullLinkUrl, out, cookies, recursiveCount);
-            }
+            return Request(fullLinkUrl, out, cookies, recursiveCount, validator);
         }
 
-        out.write(res->body.c_str(), sizeof(char) * res->body.size());
+        out.write(body.c_str(), sizeof(char) * body.size());
         return true;
     }
 
@@ -207,21 +926,44 @@ bool Request(const std::string& url, ostream& out, map<string, string> cookies =
             cerr << "Location not found to redirect. " << url << endl;
             return false;
         }
-        return Request(redirectTo, out, cookies, recursiveCount);
+        return Request(redirectTo, out, cookies, recursiveCount, validator);
     }
 
     return false;
 }
 
-bool Download(const string& url, const string& filePath)
+const size_t DEFAULT_WRITE_BUFFER_SIZE = 1024 * 1024;
+
+// stream 의 buffer 를 지정하며 연다. libstdc++ 은 열기 전에만, MSVC 는 연 뒤에만 적용되므로 양쪽 모두 지정한다.
+// buffer 가 nullptr, 0 이면 buffer 없이 읽고 쓴다.
+template<class FileStream>
+void OpenFile(FileStream& stream, const filesystem::path& filePath, ios::openmode mode, char* buffer, size_t bufferSize)
+{
+    stream.rdbuf()->pubsetbuf(buffer, static_cast<streamsize>(bufferSize));
+    stream.open(filePath, mode);
+    if (stream.is_open()) stream.rdbuf()->pubsetbuf(buffer, static_cast<streamsize>(bufferSize));
+}
+
+bool Download(const string& url, const string& filePath, size_t writeBufferSize = DEFAULT_WRITE_BUFFER_SIZE, CacheValidator* validator = nullptr)
 {
-    ofstream file(filePath, ofstream::binary);
+    vector<char> writeBuffer(writeBufferSize); // file 보다 먼저 선언 ; file 이 먼저 소멸(flush)되어야 한다.
+    ofstream file;
+    if (writeBuffer.empty()) file.open(filePath, ofstream::binary); // default buffer
+    else OpenFile(file, filePath, ofstream::binary, writeBuffer.data(), writeBuffer.size());
+    if (file.fail())
+    {
+        cerr << "could not write a file : " << filePath << endl;
+        return false;
+    }
+    if (Request(url, file, map<string, string>(), 0, validator) == false) return false;
+
+    file.close();
     if (file.fail())
     {
         cerr << "could not write a file : " << filePath << endl;
         return false;
     }
-    return Request(url, file);
+    return true;
 }
 
 std::string ReadTextFrom(const string& filePath)
@@ -240,51 +982,2175 @@ std::string ReadTextFrom(const string& filePath)
     return string(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
 }
 
-bool ExtractZip(const filesystem::path& src, filesystem::path dest, bool slicent)
+// 소유자만 읽고 쓸 수 있는 빈 파일을 새로 만든다. (있던 파일은 지운다)
+bool CreateOwnerOnlyFile(const string& filePath)
 {
-    if (!slicent) cout << "reading " << src.u8string() << endl;
-
-    if (dest.empty()) dest = "."; // current directory
+    error_code ec;
+    filesystem::remove(filesystem::u8path(filePath), ec);
+#ifdef _WIN32
+    PSECURITY_DESCRIPTOR descriptor = nullptr; // 상속 없이 소유자에게만 모든 권한
+    if (ConvertStringSecurityDescriptorToSecurityDescriptorW(L"D:P(A;;FA;;;OW)", SDDL_REVISION_1, &descriptor, nullptr) == FALSE) return false;
+    SECURITY_ATTRIBUTES attributes{ sizeof(attributes), descriptor, FALSE };
+    auto file = CreateFileW(filesystem::u8path(filePath).c_str(), GENERIC_WRITE, 0, &attributes, CREATE_NEW, FILE_ATTRIBUTE_NORMAL, nullptr);
+    LocalFree(descriptor);
+    if (file == INVALID_HANDLE_VALUE) return false;
+    CloseHandle(file);
+#else
+    auto fd = open(filePath.c_str(), O_WRONLY | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
+    if (fd < 0) return false;
+    close(fd);
+#endif
+    return true;
+}
 
-    try
+// ownerOnly 이면 소유자만 읽을 수 있는 파일로 만든다. (비밀 값)
+bool WriteTextTo(const string& filePath, const string& text, bool ownerOnly = false)
+{ // 임시 파일에 쓴 뒤 교체 ; 쓰는 도중 종료되어도 이전 내용이 남는다.
+    const auto& tmpFilePath = filePath + ".tmp";
+    if (ownerOnly && CreateOwnerOnlyFile(tmpFilePath) == false)
     {
-        miniz_cpp::zip_file zip(src.u8string()); // 잘못된 파일인 경우 std::runtime_error
+        cerr << "could not create a file : " << tmpFilePath << endl;
+        return false;
+    }
+    {
+        ofstream file(tmpFilePath, ofstream::binary);
+        file.write(text.c_str(), static_cast<streamsize>(text.size()));
+        if (file.fail())
+        {
+            cerr << "could not write a file : " << tmpFilePath << endl;
+            return false;
+        }
+    }
+    error_code ec;
+    filesystem::rename(tmpFilePath, filePath, ec);
+    if (ec)
+    {
+        cerr << "could not rename a file(" << ec.message() << ") : " << tmpFilePath << endl;
+        return false;
+    }
+    return true;
+}
+
+struct RangeProbe
+{
+    string Url; // redirection 이 끝난 실제 url
+    map<string, string> Cookies;
+    uint64_t ContentLength = 0;
+    bool AcceptRanges = false;
+    string ETag;
+    string LastModified;
+};
+
+pair<string, string> MakeRangeHeader(uint64_t first, uint64_t last)
+{ // httplib::make_range_header 는 Win32 에서 int(ssize_t) 범위라 2GB 이상을 표현하지 못한다.
+    return { "Range", "bytes=" + to_string(first) + "-" + to_string(last) };
+}
+
+// Range: bytes=0-0 요청으로 206 Partial Content 지원 여부와 전체 크기를 확인한다.
+// 200 등 range 를 무시하는 응답은 body 를 받기 전에 취소한다.
+bool ProbeRange(const string& url, RangeProbe& outProbe, int recursiveCount = 0)
+{
+    ++recursiveCount;
+    if (recursiveCount > 5)
+    {
+        cerr << "too many rediection." << url << endl;
+        return false;
+    }
+
+    auto sepPos = GetPathSepIndex(url);
+    auto serverAddress = url.substr(0, sepPos);
+    auto path = url.substr(sepPos);
+
+    auto headers = httplib::Headers();
+    if (outProbe.Cookies.empty() == false) headers.insert({ "Cookie", MakeCookieValue(outProbe.Cookies) });
+    headers.insert(MakeRangeHeader(0, 0));
+
+    auto& pool = ClientPool::GetInstance();
+    auto client = pool.Acquire(serverAddress);
+    auto res = pool.Send(*client,
+        [&](httplib::ResponseHandler handler) { return client->Get(path.c_str(), headers, handler, [](const char*, size_t) { return true; }); },
+        [](const httplib::Response& response) { return response.status == 206 || response.status == 302; });
+    if (res.error() == httplib::Error::Canceled) return true; // range not supported
+    if (res.error() != httplib::Error::Success)
+    {
+        cerr << "http client error(" << res.error() << ") : " << url << endl;
+        return false;
+    }
+    client = ClientPool::Lease(); // redirect 가 같은 연결을 쓰도록 먼저 돌려준다.
+    StoreCookies(res.value(), outProbe.Cookies);
+
+    if (res->status == 302) // redirection
+    {
+        auto redirectTo = res->get_header_value("Location");
+        if (redirectTo.empty())
+        {
+            cerr << "Location not found to redirect. " << url << endl;
+            return false;
+        }
+        return ProbeRange(redirectTo, outProbe, recursiveCount);
+    }
+
+    // Content-Range: bytes 0-0/<total>
+    const auto& contentRange = res->get_header_value("Content-Range");
+    auto slashPos = contentRange.rfind('/');
+    if (slashPos == string::npos || slashPos + 1 >= contentRange.size() || contentRange[slashPos + 1] == '*') return true; // unknown length
+    outProbe.Url = url;
+    outProbe.ContentLength = stoull(contentRange.substr(slashPos + 1));
+    outProbe.AcceptRanges = true;
+    outProbe.ETag = res->get_header_value("ETag");
+    outProbe.LastModified = res->get_header_value("Last-Modified");
+    return true;
+}
+
+struct ByteRange
+{
+    uint64_t First = 0;
+    uint64_t Last = 0; // inclusive
+    JS_OBJ(First, Last);
+};
+
+// 받는 중인 파일 옆(<file>.journal)에 받은 구간과 원본의 ETag/Last-Modified 를 기록해 두었다가
+// 다음 실행에서 같은 원본이면 남은 구간만 요청한다.
+class DownloadJournal
+{
+public:
+    string Url;
+    string ETag;
+    string LastModified;
+    uint64_t ContentLength = 0;
+    vector<ByteRange> Completed; // sorted, not overlapped
+    JS_OBJ(Url, ETag, LastModified, ContentLength, Completed);
+
+    bool Load(const string& json)
+    {
+        return LoadFrom(*this, json);
+    }
+
+    // 같은 원본인지 ; validator 가 없으면 바뀌었는지 알 수 없으므로 이어받지 않는다.
+    bool IsResumable(const string& url, const RangeProbe& probe) const
+    {
+        if (ETag.empty() && LastModified.empty()) return false;
+        return Url == url && ETag == probe.ETag && LastModified == probe.LastModified
+            && ContentLength == probe.ContentLength;
+    }
+
+    uint64_t GetCompletedSize() const
+    {
+        uint64_t size = 0;
+        for (const auto& r : Completed) size += r.Last - r.First + 1;
+        return size;
+    }
+
+    // 앞에서부터 빈틈 없이 받은 크기
+    uint64_t GetContiguousSize()
+    {
+        lock_guard<mutex> lock(journalLock);
+        if (Completed.empty() || Completed.front().First != 0) return 0;
+        return Completed.front().Last + 1;
+    }
+
+    vector<ByteRange> GetMissingRanges() const
+    {
+        vector<ByteRange> missing;
+        uint64_t next = 0;
+        for (const auto& r : Completed)
+        {
+            if (r.First > next) missing.push_back({ next, r.First - 1 });
+            next = r.Last + 1;
+        }
+        if (next < ContentLength) missing.push_back({ next, ContentLength - 1 });
+        return missing;
+    }
+
+    void Complete(uint64_t first, uint64_t last)
+    {
+        lock_guard<mutex> lock(journalLock);
+        auto i = Completed.begin();
+        while (i != Completed.end() && i->Last + 1 < first) ++i;
+        ByteRange merged{ first, last };
+        while (i != Completed.end() && i->First <= last + 1)
+        { // overlapped or adjacent
+            merged.First = min(merged.First, i->First);
+            merged.Last = max(merged.Last, i->Last);
+            i = Completed.erase(i);
+        }
+        Completed.insert(i, merged);
+    }
+
+    bool Save(const string& journalPath)
+    {
+        lock_guard<mutex> lock(journalLock);
+        return WriteTextTo(journalPath, JS::serializeStruct(*this));
+    }
+
+private:
+    mutex journalLock;
+};
+
+// 받는 중인 파일의 앞에서부터 연속으로 기록된 크기를 다른 thread(ExtractZipStream) 에 알린다.
+class DownloadProgress
+{
+public:
+    void SetAvailable(uint64_t bytes)
+    {
+        {
+            lock_guard<mutex> lock(progressLock);
+            available = max(available, bytes);
+        }
+        updated.notify_all();
+    }
+
+    void Complete(uint64_t totalBytes)
+    {
+        {
+            lock_guard<mutex> lock(progressLock);
+            available = max(available, totalBytes);
+            finished = true;
+        }
+        updated.notify_all();
+    }
+
+    void Abort()
+    {
+        {
+            lock_guard<mutex> lock(progressLock);
+            finished = true;
+        }
+        updated.notify_all();
+    }
+
+    // bytes 만큼 기록될 때까지 대기. 다운로드가 그 전에 끝나면(실패 포함) false
+    bool WaitFor(uint64_t bytes)
+    {
+        unique_lock<mutex> lock(progressLock);
+        updated.wait(lock, [&]() { return available >= bytes || finished; });
+        return available >= bytes;
+    }
+
+    uint64_t GetAvailable()
+    {
+        lock_guard<mutex> lock(progressLock);
+        return available;
+    }
+
+private:
+    mutex progressLock;
+    condition_variable updated;
+    uint64_t available = 0;
+    bool finished = false;
+};
+
+const uint64_t JOURNAL_INTERVAL = 1024 * 1024; // 이 크기만큼 받을 때마다 journal 갱신
+
+// [first, last] 구간을 file 의 같은 위치에 기록. 연결이 끊기면 받은 곳부터 다시 요청한다.
+// onWritten 은 file 에 flush 된 구간을 알린다.
+bool DownloadRange(httplib::Client& client, const string& path, const httplib::Headers& baseHeaders
+    , uint64_t first, uint64_t last, fstream& file, const function<void(uint64_t, uint64_t)>& onWritten)
+{
+    const int MAX_RETRY = 3;
+    auto offset = first;
+    auto reported = first;
+    auto report = [&]()
+    {
+        if (reported == offset) return;
+        file.flush();
+        if (file.good()) onWritten(reported, offset - 1);
+        reported = offset;
+    };
+
+    for (int retry = 0; retry < MAX_RETRY && offset <= last; ++retry)
+    {
+        auto headers = baseHeaders;
+        headers.insert(MakeRangeHeader(offset, last));
+        file.seekp(static_cast<streamoff>(offset));
+        int status = 0;
+        auto res = client.Get(path.c_str(), headers,
+            ClientPool::GetInstance().Measure(client, [&](const httplib::Response& response)
+            {
+                status = response.status;
+                return status == 206;
+            }),
+            [&](const char* data, size_t length)
+            {
+                if (offset + length > last + 1) return false; // server sent more than requested
+                file.write(data, static_cast<streamsize>(length));
+                offset += length;
+                if (offset - reported >= JOURNAL_INTERVAL) report();
+                return file.good();
+            });
+        report();
+        if (file.good() == false) return false;
+        if (status != 0 && status != 206)
+        { // If-Range 가 맞지 않으면 200 으로 전체를 보낸다
+            cerr << "unexpected http status(" << status << "), source may be changed" << endl;
+            return false;
+        }
+    }
+    return offset > last;
+}
+
+const uint64_t MIN_SEGMENT_SIZE = 4 * 1024 * 1024;
+
+// 여러 연결로 구간을 나누어 동시에 받는다. 미리 전체 크기로 만든 파일에 각 worker 가 자신의 file handle 로
+// 해당 위치에 기록(pwrite 와 같은 방식). range 를 지원하지 않는 서버는 Download() 로 대신한다.
+// 중단되었던 같은 원본의 journal 이 있으면 남은 구간만 받는다.
+// progress 가 있으면 앞에서부터 연속으로 받은 크기를 알린다. (range 를 지원하지 않는 경우 완료 후에)
+bool DownloadSegmented(const string& url, const string& filePath, size_t connections, size_t writeBufferSize = DEFAULT_WRITE_BUFFER_SIZE
+    , DownloadProgress* progress = nullptr)
+{
+    const auto& journalPath = filePath + ".journal";
+    Metrics::Phase phase("download");
+
+    RangeProbe probe;
+    if (ProbeRange(url, probe) == false) return false;
+    if (probe.AcceptRanges == false)
+    {
+        filesystem::remove(journalPath);
+        if (Download(url, filePath, writeBufferSize) == false) return false;
+        phase.Add(filesystem::file_size(filePath), 1);
+        return true;
+    }
+
+    DownloadJournal journal;
+    bool resume = filesystem::exists(journalPath) && filesystem::exists(filePath)
+        && journal.Load(ReadTextFrom(journalPath)) && journal.IsResumable(url, probe)
+        && filesystem::file_size(filePath) == probe.ContentLength;
+    if (resume)
+    {
+        cout << "resuming download, " << journal.GetCompletedSize() << " of " << probe.ContentLength << " bytes received" << endl;
+        if (progress) progress->SetAvailable(journal.GetContiguousSize());
+    }
+    else
+    {
+        journal.Url = url;
+        journal.ETag = probe.ETag;
+        journal.LastModified = probe.LastModified;
+        journal.ContentLength = probe.ContentLength;
+        journal.Completed.clear();
+
+        // preallocating
+        {
+            ofstream file(filePath, ofstream::binary);
+            if (file.fail())
+            {
+                cerr << "could not write a file : " << filePath << endl;
+                return false;
+            }
+        }
+        error_code ec;
+        filesystem::resize_file(filePath, probe.ContentLength, ec);
+        if (ec)
+        {
+            cerr << "could not allocate a file(" << ec.message() << ") : " << filePath << endl;
+            return false;
+        }
+        if (journal.Save(journalPath) == false) return false;
+    }
+
+    // 연결 수보다 잘게 나누어 느린 연결이 전체를 붙잡지 않도록 한다.
+    connections = max<size_t>(connections, 1);
+    const auto missingRanges = journal.GetMissingRanges();
+    uint64_t missingSize = 0;
+    for (const auto& r : missingRanges) missingSize += r.Last - r.First + 1;
+    const auto segmentSize = max(MIN_SEGMENT_SIZE, (missingSize + connections * 4 - 1) / (connections * 4));
+    vector<ByteRange> segments;
+    for (const auto& r : missingRanges)
+    {
+        for (auto first = r.First; first <= r.Last; first += segmentSize)
+        {
+            segments.push_back({ first, min(first + segmentSize - 1, r.Last) });
+        }
+    }
+
+    const auto serverAddress = probe.Url.substr(0, GetPathSepIndex(probe.Url));
+    const auto path = probe.Url.substr(serverAddress.size());
+    auto headers = httplib::Headers();
+    if (probe.Cookies.empty() == false) headers.insert({ "Cookie", MakeCookieValue(probe.Cookies) });
+    if (probe.ETag.empty() == false) headers.insert({ "If-Range", probe.ETag });
+    else if (probe.LastModified.empty() == false) headers.insert({ "If-Range", probe.LastModified });
+
+    atomic<size_t> nextSegment(0);
+    atomic<bool> failed(false);
+    mutex errorLock;
+    auto onWritten = [&](uint64_t first, uint64_t last)
+    {
+        journal.Complete(first, last);
+        journal.Save(journalPath);
+        if (progress) progress->SetAvailable(journal.GetContiguousSize());
+    };
+    vector<thread> workers;
+    for (size_t i = 0; i < min(connections, segments.size()); ++i)
+    {
+        workers.emplace_back([&]()
+        {
+            vector<char> writeBuffer(writeBufferSize);
+            fstream file;
+            const auto& mode = fstream::in | fstream::out | fstream::binary;
+            if (writeBuffer.empty()) file.open(filePath, mode); // default buffer
+            else OpenFile(file, filePath, mode, writeBuffer.data(), writeBuffer.size());
+
+            auto client = ClientPool::GetInstance().Acquire(serverAddress); // 첫 worker 는 ProbeRange 의 연결을 이어 쓴다.
+
+            for (size_t segment; file.good() && failed == false && (segment = nextSegment++) < segments.size();)
+            {
+                const auto& range = segments[segment];
+                if (DownloadRange(*client, path, headers, range.First, range.Last, file, onWritten)) continue;
+
+                lock_guard<mutex> lock(errorLock);
+                cerr << "could not download range " << range.First << "-" << range.Last << " : " << probe.Url << endl;
+                failed = true;
+            }
+            file.close();
+            if (file.fail()) failed = true;
+        });
+    }
+    for (auto& w : workers) w.join();
+
+    if (failed)
+    {
+        cerr << "download incomplete, it will be resumed next time : " << filePath << endl;
+        return false;
+    }
+    filesystem::remove(journalPath);
+    phase.Add(missingSize, 1);
+    return true;
+}
+
+// 읽기 전용 memory map. 실패하면(32bit 의 주소 공간 부족 등) IsValid() == false
+class MappedFile
+{
+public:
+    explicit MappedFile(const filesystem::path& filePath)
+    {
+#ifdef _WIN32
+        file = CreateFileW(filePath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE) return;
+        LARGE_INTEGER fileSize;
+        if (GetFileSizeEx(file, &fileSize) == FALSE || static_cast<uint64_t>(fileSize.QuadPart) > numeric_limits<size_t>::max()) return;
+        mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (mapping == nullptr) return;
+        data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        if (data) size = static_cast<size_t>(fileSize.QuadPart);
+#else
+        auto fd = open(filePath.c_str(), O_RDONLY);
+        if (fd < 0) return;
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0)
+        {
+            auto mapped = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapped != MAP_FAILED)
+            {
+                data = mapped;
+                size = static_cast<size_t>(st.st_size);
+            }
+        }
+        close(fd);
+#endif
+    }
+
+    ~MappedFile()
+    {
+#ifdef _WIN32
+        if (data) UnmapViewOfFile(data);
+        if (mapping) CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+#else
+        if (data) munmap(const_cast<void*>(data), size);
+#endif
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool IsValid() const { return data != nullptr; }
+    const void* GetData() const { return data; }
+    size_t GetSize() const { return size; }
+
+private:
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+#endif
+    const void* data = nullptr;
+    size_t size = 0;
+};
+
+// 설치된 파일들의 (크기, 수정 시각, inode) 와 그때의 hash 를 기록해 둔다.
+// 다음에는 stat 만으로 바뀌지 않았음을 알 수 있으므로 metadata 가 바뀐 파일만 hash 를 다시 계산하면 된다.
+// thread safe
+class FileStateIndex
+{
+public:
+    // 파일이 없거나 형식이 다르면 빈 index
+    bool Load(const filesystem::path& indexPath)
+    {
+        lock_guard<mutex> lock(stateLock);
+        states.clear();
+        ifstream file(indexPath, ifstream::binary);
+        if (file.is_open() == false) return false;
+
+        char magic[sizeof(MAGIC)] = {};
+        uint32_t count = 0;
+        if (file.read(magic, sizeof(magic)).fail() || memcmp(magic, MAGIC, sizeof(MAGIC)) != 0 || Get(file, count) == false) return false;
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            string path;
+            FileState state;
+            if (GetString(file, path) == false || Get(file, state.Size) == false || Get(file, state.ModifiedTime) == false
+                || Get(file, state.Inode) == false || Get(file, state.HashedTime) == false || Get(file, state.HasCrc32) == false
+                || Get(file, state.Crc32) == false || GetString(file, state.Sha256) == false)
+            {
+                states.clear();
+                return false;
+            }
+            states.emplace(move(path), move(state));
+        }
+        return true;
+    }
+
+    bool Save(const filesystem::path& indexPath) const
+    {
+        lock_guard<mutex> lock(stateLock);
+        auto tmpPath = indexPath;
+        tmpPath += ".tmp";
+        {
+            ofstream file(tmpPath, ofstream::binary);
+            file.write(MAGIC, sizeof(MAGIC));
+            Put(file, static_cast<uint32_t>(states.size()));
+            for (const auto& s : states)
+            {
+                PutString(file, s.first);
+                Put(file, s.second.Size);
+                Put(file, s.second.ModifiedTime);
+                Put(file, s.second.Inode);
+                Put(file, s.second.HashedTime);
+                Put(file, s.second.HasCrc32);
+                Put(file, s.second.Crc32);
+                PutString(file, s.second.Sha256);
+            }
+            file.close();
+            if (file.fail())
+            {
+                cerr << "could not write a file : " << tmpPath.u8string() << endl;
+                return false;
+            }
+        }
+        error_code ec;
+        filesystem::rename(tmpPath, indexPath, ec);
+        return !ec;
+    }
+
+    // 기록된 뒤로 바뀌지 않았으면 그때의 crc
+    bool GetCrc32(const filesystem::path& filePath, uint32_t& outCrc) const
+    {
+        lock_guard<mutex> lock(stateLock);
+        auto state = FindUnchanged(filePath);
+        if (state == nullptr || state->HasCrc32 == false) return false;
+        outCrc = state->Crc32;
+        return true;
+    }
+
+    // 기록된 뒤로 바뀌지 않았으면 그때의 sha256
+    bool GetSha256(const filesystem::path& filePath, string& outSha256) const
+    {
+        lock_guard<mutex> lock(stateLock);
+        auto state = FindUnchanged(filePath);
+        if (state == nullptr || state->Sha256.empty()) return false;
+        outSha256 = state->Sha256;
+        return true;
+    }
+
+    // 지금 파일의 내용이 이 hash 임을 기록한다. metadata 가 그대로면 다른 hash 는 유지한다.
+    void SetCrc32(const filesystem::path& filePath, uint32_t crc)
+    {
+        Update(filePath, [crc](FileState& state) { state.HasCrc32 = true; state.Crc32 = crc; });
+    }
+
+    void SetSha256(const filesystem::path& filePath, const string& sha256)
+    {
+        Update(filePath, [&sha256](FileState& state) { state.Sha256 = sha256; });
+    }
+
+    void Remove(const filesystem::path& filePath)
+    {
+        lock_guard<mutex> lock(stateLock);
+        states.erase(GetKey(filePath));
+    }
+
+    // rename 은 내용과 metadata 를 바꾸지 않으므로 기록도 그대로 옮긴다.
+    void Move(const filesystem::path& from, const filesystem::path& to)
+    {
+        lock_guard<mutex> lock(stateLock);
+        auto found = states.find(GetKey(from));
+        if (found == states.end())
+        {
+            states.erase(GetKey(to));
+            return;
+        }
+        auto state = move(found->second);
+        states.erase(found);
+        states[GetKey(to)] = move(state);
+    }
+
+private:
+    struct FileState
+    {
+        uint64_t Size = 0;
+        int64_t ModifiedTime = 0; // file_time_type ticks
+        uint64_t Inode = 0; // windows 는 0 ; handle 을 열어야 해서 쓰지 않는다.
+        int64_t HashedTime = 0; // hash 를 기록한 때
+        uint8_t HasCrc32 = 0;
+        uint32_t Crc32 = 0;
+        string Sha256;
+    };
+
+    static constexpr char MAGIC[8] = { 'P', 'F', 'S', 'I', '0', '0', '0', '2' }; // 0002 : 문자열 길이 uint32
+
+    // 수정 시각의 해상도(FAT 은 2초) 안에서 hash 를 기록한 뒤 다시 쓰인 파일은 metadata 로 구분할 수 없으므로
+    // 수정 시각이 기록한 때보다 이만큼 앞서지 않으면 믿지 않는다. 이런 파일은 다음 검사에서 hash 를 다시 계산한다.
+    static constexpr auto RACY_INTERVAL = chrono::seconds(2);
+
+    static string GetKey(const filesystem::path& filePath)
+    {
+        return filePath.lexically_normal().generic_u8string();
+    }
+
+    static int64_t GetNow()
+    {
+        return filesystem::file_time_type::clock::now().time_since_epoch().count();
+    }
+
+    static bool Stat(const filesystem::path& filePath, FileState& outState)
+    {
+        error_code ec;
+        outState.Size = filesystem::file_size(filePath, ec);
+        if (ec) return false;
+        outState.ModifiedTime = filesystem::last_write_time(filePath, ec).time_since_epoch().count();
+        if (ec) return false;
+#ifndef _WIN32
+        struct stat st;
+        if (stat(filePath.c_str(), &st) != 0) return false;
+        outState.Inode = static_cast<uint64_t>(st.st_ino);
+#endif
+        return true;
+    }
+
+    static bool IsTrusted(const FileState& state, const FileState& current)
+    {
+        if (current.Size != state.Size || current.ModifiedTime != state.ModifiedTime || current.Inode != state.Inode) return false;
+        const auto racy = chrono::duration_cast<filesystem::file_time_type::duration>(RACY_INTERVAL).count();
+        return state.ModifiedTime + racy <= state.HashedTime;
+    }
+
+    const FileState* FindUnchanged(const filesystem::path& filePath) const
+    {
+        auto found = states.find(GetKey(filePath));
+        if (found == states.end()) return nullptr;
+        FileState current;
+        if (Stat(filePath, current) == false) return nullptr;
+        return IsTrusted(found->second, current) ? &found->second : nullptr;
+    }
+
+    template<class Function>
+    void Update(const filesystem::path& filePath, Function update)
+    {
+        FileState current;
+        if (Stat(filePath, current) == false) return;
+        current.HashedTime = GetNow();
+
+        lock_guard<mutex> lock(stateLock);
+        auto& state = states[GetKey(filePath)];
+        if (IsTrusted(state, current) == false) state = current; // 이전 hash 들은 지금 내용의 것이라 할 수 없다.
+        update(state);
+    }
+
+    template<class T>
+    static void Put(ostream& stream, const T& value)
+    {
+        stream.write(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+
+    template<class T>
+    static bool Get(istream& stream, T& value)
+    {
+        return stream.read(reinterpret_cast<char*>(&value), sizeof(value)).good();
+    }
+
+    static void PutString(ostream& stream, const string& value)
+    { // 길이가 잘리면 뒤의 기록이 모두 어긋나므로 uint32
+        Put(stream, static_cast<uint32_t>(value.size()));
+        stream.write(value.data(), static_cast<streamsize>(value.size()));
+    }
+
+    static bool GetString(istream& stream, string& value)
+    {
+        uint32_t size = 0;
+        if (Get(stream, size) == false) return false;
+        value.resize(size);
+        return size == 0 || stream.read(&value[0], size).good();
+    }
+
+    mutable mutex stateLock;
+    unordered_map<string, FileState> states;
+};
+
+const size_t EXTRACT_WRITE_BUFFER_SIZE = 256 * 1024;
+
+// 이미 같은 내용(크기와 crc)의 파일이 있는지. index 에 기록된 뒤로 바뀌지 않았으면 파일을 읽지 않는다.
+bool IsUnchanged(const filesystem::path& target, uint64_t size, uint32_t crc, FileStateIndex* index = nullptr)
+{
+    error_code ec;
+    if (filesystem::is_regular_file(target, ec) == false || filesystem::file_size(target, ec) != size || ec) return false;
+
+    uint32_t indexedCrc = 0;
+    if (index && index->GetCrc32(target, indexedCrc)) return indexedCrc == crc;
+
+    ifstream file(target, ifstream::binary);
+    if (file.is_open() == false) return false;
+    vector<char> buffer(static_cast<size_t>(min<uint64_t>(size, EXTRACT_WRITE_BUFFER_SIZE)) + 1);
+    uint32_t actualCrc = 0;
+    while (file)
+    {
+        file.read(buffer.data(), static_cast<streamsize>(buffer.size()));
+        actualCrc = Crc32(actualCrc, buffer.data(), static_cast<size_t>(file.gcount()));
+    }
+    if (file.bad()) return false;
+    if (index) index->SetCrc32(target, actualCrc);
+    return actualCrc == crc;
+}
+
+// entry 를 dest 에 다시 풀 필요가 없는지. 앞서 멈춘 압축 풀기가 dest(staging)에 이미 쓴 파일을 먼저 보고 base 와 비교한다.
+// base 와 같을 때 dest 에 남은 다른 내용(도중에 끊긴 파일)은 지워 base 의 파일이 그대로 쓰이게 한다.
+bool IsExtracted(const filesystem::path& dest, const filesystem::path& base, const string& filename, uint64_t size, uint32_t crc, FileStateIndex* index)
+{
+    const auto& path = filesystem::u8path(filename);
+    if (IsUnchanged(dest / path, size, crc, index)) return true;
+    if (base == dest || IsUnchanged(base / path, size, crc, index) == false) return false;
+    error_code ec;
+    filesystem::remove(dest / path, ec);
+    return !ec;
+}
+
+// 압축을 풀며 쓴 파일과 같은 내용이라 건너뛴 파일
+struct ExtractCounter
+{
+    atomic<size_t> ExtractedFiles{ 0 };
+    atomic<uint64_t> ExtractedBytes{ 0 };
+    atomic<size_t> SkippedFiles{ 0 };
+    atomic<uint64_t> SkippedBytes{ 0 };
+
+    void Print() const
+    {
+        cout << ExtractedFiles << " files extracted (" << ExtractedBytes << " bytes), "
+            << SkippedFiles << " unchanged files skipped (" << SkippedBytes << " bytes)" << endl;
+    }
+};
+
+// 압축을 풀며 바로 파일에 쓴다.
+bool ExtractEntry(miniz_cpp::zip_file& zip, const miniz_cpp::zip_info& info, const filesystem::path& dest, vector<char>& writeBuffer)
+{
+    const auto& target = dest / filesystem::u8path(info.filename);
+    ofstream file;
+    OpenFile(file, target, ofstream::binary, writeBuffer.data(), writeBuffer.size());
+    if (file.fail())
+    {
+        cerr << "could not write a file : " << target.u8string() << endl;
+        return false;
+    }
+    if (zip.extract_to(info, file) == false)
+    {
+        cerr << "could not extract : " << info.filename << endl;
+        return false;
+    }
+    file.close();
+    if (file.fail())
+    {
+        cerr << "could not write a file : " << target.u8string() << endl;
+        return false;
+    }
+    return true;
+}
+
+// directory 를 모두 만든 뒤 파일들을 jobs 개의 thread 로 나누어 푼다.
+// 큰 파일이 마지막에 혼자 남지 않도록 큰 것부터 나누어 준다.
+// 각 thread 는 같은 mapping 위에 자신의 zip reader(inflate 상태)를 따로 갖는다.
+// incremental 이면 크기와 crc 가 같은 파일은 다시 쓰지 않는다. index 가 있으면 푼 파일들의 crc 를 기록한다.
+// base 가 있으면 dest 다음으로 base 의 파일과 비교하고, 같은 파일은 dest 에 쓰지 않는다. (staging)
+bool ExtractZip(const filesystem::path& src, filesystem::path dest, bool slicent, size_t jobs = 1, bool incremental = false
+    , FileStateIndex* index = nullptr, filesystem::path base = filesystem::path())
+{
+    if (!slicent) cout << "reading " << src.u8string() << endl;
+    Metrics::Phase phase("extract");
+
+    if (dest.empty()) dest = "."; // current directory
+    if (base.empty()) base = dest;
+
+    // archive 전체를 memory 로 복사하지 않도록 mapping 된 파일을 그대로 읽는다.
+    // mapping 할 수 없으면 miniz 의 file reader 로 필요한 부분만 읽는다.
+    MappedFile mapped(src); // zip 보다 먼저 선언 ; zip 이 먼저 소멸되어야 한다.
+    auto openZip = [&](miniz_cpp::zip_file& zip)
+    {
+        if (mapped.IsValid()) zip.load_view(mapped.GetData(), mapped.GetSize()); // 잘못된 파일인 경우 std::runtime_error
+        else zip.load_file(src.string());
+    };
+
+    vector<miniz_cpp::zip_info> files;
+    try
+    {
+        miniz_cpp::zip_file zip;
+        openZip(zip);
+
+        set<filesystem::path> parents;
+        for (auto& f : zip.infolist())
+        {
+            if (f.filename.back() == '/') // directory
+            {
+                if (!slicent) cout << "extracting " << f.filename << " ... ";
+                const auto& target = dest / filesystem::u8path(f.filename);
+                if (filesystem::exists(target))
+                {
+                    if (!slicent) cout << "exists" << endl;
+                    continue;
+                }
+                filesystem::create_directories(target); // 모든 상위 directory 를 생성하지 못하는 경우,
+                                                     // 실제 directory 를 올바르게 생성했다 하더라도 false 를 return 할 수 있음.
+                if (!slicent) cout << "created" << endl;
+                continue;
+            }
+            const auto& parent = (dest / filesystem::u8path(f.filename)).parent_path();
+            if (parents.insert(parent).second) filesystem::create_directories(parent);
+            files.push_back(move(f));
+        }
+    }
+    catch (const runtime_error& e)
+    {
+        cerr << e.what() << endl;
+        return false;
+    }
+
+    sort(files.begin(), files.end(), [](const miniz_cpp::zip_info& a, const miniz_cpp::zip_info& b) { return a.file_size > b.file_size; });
+
+    atomic<size_t> next(0);
+    atomic<bool> failed(false);
+    mutex outputLock;
+    ExtractCounter counter;
+    auto extract = [&]()
+    {
+        try
+        {
+            miniz_cpp::zip_file zip;
+            openZip(zip);
+            vector<char> writeBuffer(EXTRACT_WRITE_BUFFER_SIZE); // thread 의 모든 entry 가 같은 buffer 를 쓴다.
+            for (size_t i; failed == false && (i = next++) < files.size();)
+            {
+                const auto& f = files[i];
+                if (incremental && IsExtracted(dest, base, f.filename, f.file_size, f.crc, index))
+                {
+                    ++counter.SkippedFiles;
+                    counter.SkippedBytes += f.file_size;
+                    if (slicent) continue;
+                    lock_guard<mutex> lock(outputLock);
+                    cout << "extracting " << f.filename << " ... unchanged" << endl;
+                    continue;
+                }
+                if (ExtractEntry(zip, f, dest, writeBuffer) == false)
+                {
+                    failed = true;
+                    break;
+                }
+                if (index) index->SetCrc32(dest / filesystem::u8path(f.filename), f.crc); // extract 할 때 crc 를 확인한다.
+                ++counter.ExtractedFiles;
+                counter.ExtractedBytes += f.file_size;
+                if (slicent) continue;
+                lock_guard<mutex> lock(outputLock);
+                cout << "extracting " << f.filename << " ... done" << endl;
+            }
+        }
+        catch (const runtime_error& e)
+        {
+            lock_guard<mutex> lock(outputLock);
+            cerr << e.what() << endl;
+            failed = true;
+        }
+    };
+
+    vector<thread> workers;
+    for (size_t i = 1; i < min(max<size_t>(jobs, 1), files.size()); ++i) workers.emplace_back(extract);
+    extract(); // current thread is one of the workers
+    for (auto& w : workers) w.join();
+
+    if (!slicent) counter.Print();
+    phase.Add(counter.ExtractedBytes, counter.ExtractedFiles);
+    return failed == false;
+}
+
+// 받는 중인 파일을 앞에서부터 읽는다. 아직 기록되지 않은 곳은 DownloadProgress 로 기다린다.
+// 미리 할당된(0 으로 채워진) 영역을 읽어 두지 않도록 stream 자체의 buffer 는 쓰지 않는다.
+class ProgressiveReader
+{
+public:
+    ProgressiveReader(const filesystem::path& filePath, DownloadProgress& progress)
+        : filePath(filePath)
+        , progress(progress)
+        , buffer(BUFFER_SIZE)
+    {
+    }
+
+    bool Read(void* dest, size_t size)
+    {
+        auto out = static_cast<char*>(dest);
+        while (size > 0)
+        {
+            if (begin == end && Fill() == false) return false;
+            auto n = min(size, end - begin);
+            memcpy(out, buffer.data() + begin, n);
+            begin += n;
+            out += n;
+            size -= n;
+        }
+        return true;
+    }
+
+    bool Skip(uint64_t size)
+    {
+        char discard[4096];
+        while (size > 0)
+        {
+            auto n = static_cast<size_t>(min<uint64_t>(size, sizeof(discard)));
+            if (Read(discard, n) == false) return false;
+            size -= n;
+        }
+        return true;
+    }
+
+    // 최대 size 만큼 buffer 에 있는 데이터를 그대로 빌려준다. 없으면 채울 때까지 기다린다.
+    bool Peek(const char*& outData, size_t& inOutSize)
+    {
+        if (begin == end && Fill() == false) return false;
+        outData = buffer.data() + begin;
+        inOutSize = min(inOutSize, end - begin);
+        return true;
+    }
+
+    void Consume(size_t size) { begin += size; }
+
+private:
+    bool Fill()
+    {
+        if (progress.WaitFor(position + 1) == false) return false;
+        if (file.is_open() == false)
+        { // 다운로드가 시작되어야 파일이 생긴다.
+            OpenFile(file, filePath, ifstream::binary, nullptr, 0);
+            if (file.is_open() == false)
+            {
+                cerr << "file could not be opened. " << filePath.u8string() << endl;
+                return false;
+            }
+        }
+        auto size = static_cast<size_t>(min<uint64_t>(BUFFER_SIZE, progress.GetAvailable() - position));
+        file.seekg(static_cast<streamoff>(position));
+        file.read(buffer.data(), static_cast<streamsize>(size));
+        if (file.gcount() != static_cast<streamsize>(size)) return false;
+        position += size;
+        begin = 0;
+        end = size;
+        return true;
+    }
+
+    static const size_t BUFFER_SIZE = 256 * 1024;
+    filesystem::path filePath;
+    DownloadProgress& progress;
+    ifstream file;
+    vector<char> buffer;
+    size_t begin = 0;
+    size_t end = 0;
+    uint64_t position = 0; // file position of buffer end
+};
+
+uint16_t ReadLE16(const uint8_t* p) { return static_cast<uint16_t>(p[0] | (p[1] << 8)); }
+uint32_t ReadLE32(const uint8_t* p) { return ReadLE16(p) | (static_cast<uint32_t>(ReadLE16(p + 2)) << 16); }
+uint64_t ReadLE64(const uint8_t* p) { return ReadLE32(p) | (static_cast<uint64_t>(ReadLE32(p + 4)) << 32); }
+
+const uint16_t ZIP_METHOD_STORED = 0;
+const uint16_t ZIP_METHOD_DEFLATED = 8;
+
+// zip entry 하나의 압축 데이터를 들어오는 대로(조각이 나뉘어 있어도) 풀어 output 으로 내보낸다.
+class EntryDecoder
+{
+public:
+    using Output = function<bool(const char* data, size_t size)>;
+
+    EntryDecoder(uint16_t method, uint64_t compressedSize, const Output& output)
+        : method(method)
+        , remains(compressedSize)
+        , output(output)
+    {
+        tinfl_init(&inflator);
+    }
+
+    static bool IsSupported(uint16_t method) { return method == ZIP_METHOD_STORED || method == ZIP_METHOD_DEFLATED; }
+
+    // 압축 데이터 크기보다 많이 넣거나, 손상된 데이터, output 실패이면 false
+    bool Write(const char* data, size_t size)
+    {
+        if (size > remains) return false;
+        if (method == ZIP_METHOD_STORED)
+        {
+            remains -= size;
+            return size == 0 || output(data, size);
+        }
+
+        if (dictionary.empty() && size == remains && GetInflateBackend() == InflateBackend::FAST)
+        { // 처음에 한 번에 다 왔으면 빠른 decoder 로
+            remains = 0;
+            finished = Inflate(data, size, [this](const uint8_t* d, size_t n) { return output(reinterpret_cast<const char*>(d), n); });
+            return finished;
+        }
+
+        if (dictionary.empty()) dictionary.resize(TINFL_LZ_DICT_SIZE);
+        for (;;)
+        {
+            auto inSize = size;
+            auto outSize = TINFL_LZ_DICT_SIZE - dictionaryOffset;
+            auto flags = remains > size ? TINFL_FLAG_HAS_MORE_INPUT : 0; // 마지막 조각인지 알려야 한다.
+            auto status = tinfl_decompress(&inflator, reinterpret_cast<const mz_uint8*>(data), &inSize
+                , dictionary.data(), dictionary.data() + dictionaryOffset, &outSize, flags);
+            data += inSize;
+            size -= inSize;
+            remains -= inSize;
+            if (outSize > 0 && output(reinterpret_cast<const char*>(dictionary.data() + dictionaryOffset), outSize) == false) return false;
+            dictionaryOffset = (dictionaryOffset + outSize) & (TINFL_LZ_DICT_SIZE - 1);
+
+            if (status == TINFL_STATUS_DONE)
+            {
+                finished = true;
+                return true;
+            }
+            if (status < TINFL_STATUS_DONE) return false; // corrupted
+            if (status == TINFL_STATUS_NEEDS_MORE_INPUT) return remains > 0; // 다 넣었는데 끝나지 않았다면 truncated
+        }
+    }
+
+    bool IsFinished() const { return method == ZIP_METHOD_STORED ? remains == 0 : finished; }
+
+private:
+    uint16_t method;
+    uint64_t remains;
+    Output output;
+    tinfl_decompressor inflator;
+    vector<mz_uint8> dictionary; // tinfl 로 풀기 시작하면 할당
+    size_t dictionaryOffset = 0;
+    bool finished = false;
+};
+
+// 받는 중인 zip 을 local file header 순서대로 읽으며 entry 하나의 압축 데이터가 다 도착하는 대로 풀어 쓴다.
+// data descriptor 를 쓰는 entry(크기를 미리 알 수 없음), 암호화 등 지원하지 않는 형식이면 false ;
+// 이때는 다운로드가 끝난 뒤 ExtractZip() 으로 처음부터 다시 푼다.
+// incremental 이면 크기와 crc 가 같은 파일은 압축 데이터를 건너뛴다. index 가 있으면 푼 파일들의 crc 를 기록한다.
+// base 가 있으면 dest 다음으로 base 의 파일과 비교한다. (ExtractZip 과 같음)
+bool ExtractZipStream(const filesystem::path& src, DownloadProgress& progress, filesystem::path dest, bool slicent, bool incremental = false
+    , FileStateIndex* index = nullptr, filesystem::path base = filesystem::path())
+{
+    const uint32_t LOCAL_FILE_HEADER_SIGNATURE = 0x04034b50;
+    const uint32_t CENTRAL_DIRECTORY_SIGNATURE = 0x02014b50;
+    const uint32_t END_OF_CENTRAL_DIRECTORY_SIGNATURE = 0x06054b50;
+    const uint16_t FLAG_ENCRYPTED = 0x0001;
+    const uint16_t FLAG_DATA_DESCRIPTOR = 0x0008;
+
+    if (dest.empty()) dest = "."; // current directory
+    if (base.empty()) base = dest;
+
+    Metrics::Phase phase("extract"); // 받는 동안 기다린 시간도 들어간다.
+    ProgressiveReader reader(src, progress);
+    ExtractCounter counter;
+    for (;;)
+    {
+        uint8_t header[30];
+        if (reader.Read(header, 4) == false) return false;
+        auto signature = ReadLE32(header);
+        if (signature == CENTRAL_DIRECTORY_SIGNATURE || signature == END_OF_CENTRAL_DIRECTORY_SIGNATURE)
+        { // all entries done
+            if (!slicent) counter.Print();
+            phase.Add(counter.ExtractedBytes, counter.ExtractedFiles);
+            return true;
+        }
+        if (signature != LOCAL_FILE_HEADER_SIGNATURE) return false;
+        if (reader.Read(header + 4, sizeof(header) - 4) == false) return false;
+
+        auto flags = ReadLE16(header + 6);
+        auto method = ReadLE16(header + 8);
+        auto crc = ReadLE32(header + 14);
+        uint64_t compressedSize = ReadLE32(header + 18);
+        uint64_t size = ReadLE32(header + 22);
+        string filename(ReadLE16(header + 26), '\0');
+        vector<uint8_t> extra(ReadLE16(header + 28));
+        if (reader.Read(&filename[0], filename.size()) == false) return false;
+        if (reader.Read(extra.data(), extra.size()) == false) return false;
+
+        if (flags & (FLAG_ENCRYPTED | FLAG_DATA_DESCRIPTOR)) return false;
+        if (EntryDecoder::IsSupported(method) == false) return false;
+        if (compressedSize == 0xFFFFFFFF || size == 0xFFFFFFFF)
+        { // zip64 extended information extra field
+            for (size_t i = 0; i + 4 <= extra.size();)
+            {
+                auto id = ReadLE16(&extra[i]);
+                auto length = ReadLE16(&extra[i + 2]);
+                auto field = i + 4;
+                if (id == 0x0001)
+                {
+                    if (size == 0xFFFFFFFF && field + 8 <= extra.size()) { size = ReadLE64(&extra[field]); field += 8; }
+                    if (compressedSize == 0xFFFFFFFF && field + 8 <= extra.size()) { compressedSize = ReadLE64(&extra[field]); }
+                    break;
+                }
+                i = field + length;
+            }
+            if (compressedSize == 0xFFFFFFFF || size == 0xFFFFFFFF) return false;
+        }
+
+        if (!slicent) cout << "extracting " << filename << " ... ";
+        const auto& target = dest / filesystem::u8path(filename);
+        if (filename.back() == '/') // directory
+        {
+            if (reader.Skip(compressedSize) == false) return false;
+            if (filesystem::exists(target))
+            {
+                if (!slicent) cout << "exists" << endl;
+                continue;
+            }
+            filesystem::create_directories(target);
+            if (!slicent) cout << "created" << endl;
+            continue;
+        }
+
+        if (incremental && IsExtracted(dest, base, filename, size, crc, index))
+        {
+            if (reader.Skip(compressedSize) == false) return false;
+            ++counter.SkippedFiles;
+            counter.SkippedBytes += size;
+            if (!slicent) cout << "unchanged" << endl;
+            continue;
+        }
+
+        if (target.has_parent_path()) filesystem::create_directories(target.parent_path());
+        ofstream file(target, ofstream::binary);
+        if (file.fail())
+        {
+            cerr << "could not write a file : " << target.u8string() << endl;
+            return false;
+        }
+
+        uint32_t actualCrc = 0;
+        uint64_t written = 0;
+        EntryDecoder decoder(method, compressedSize, [&](const char* data, size_t length)
+        {
+            actualCrc = Crc32(actualCrc, data, length);
+            file.write(data, static_cast<streamsize>(length));
+            written += length;
+            return file.good();
+        });
+        auto remains = compressedSize;
+        while (remains > 0)
+        { // 압축 데이터 크기만큼만 읽어 다음 entry 를 미리 읽지 않게 한다.
+            const char* data;
+            auto length = static_cast<size_t>(min<uint64_t>(remains, numeric_limits<size_t>::max()));
+            if (reader.Peek(data, length) == false) return false;
+            auto decoded = decoder.Write(data, length);
+            reader.Consume(length);
+            remains -= length;
+            if (decoded == false) break; // corrupted or write error
+        }
+        if (remains > 0 && reader.Skip(remains) == false) return false;
+
+        file.close();
+        if (file.fail())
+        {
+            cerr << "could not write a file : " << target.u8string() << endl;
+            return false;
+        }
+        if (written != size || actualCrc != crc)
+        {
+            cerr << "crc mismatch : " << filename << endl;
+            return false;
+        }
+        if (index) index->SetCrc32(target, crc);
+        ++counter.ExtractedFiles;
+        counter.ExtractedBytes += size;
+        if (!slicent) cout << "done" << endl;
+    }
+}
+
+class Sha256
+{
+public:
+    Sha256() : context(EVP_MD_CTX_new())
+    {
+        EVP_DigestInit_ex(context, EVP_sha256(), nullptr);
+    }
+
+    ~Sha256()
+    {
+        EVP_MD_CTX_free(context);
+    }
+
+    Sha256(const Sha256&) = delete;
+    Sha256& operator=(const Sha256&) = delete;
+
+    void Update(const void* data, size_t size)
+    {
+        EVP_DigestUpdate(context, data, size);
+    }
+
+    string GetHex() // lower case
+    {
+        unsigned char digest[EVP_MAX_MD_SIZE];
+        unsigned int size = 0;
+        EVP_DigestFinal_ex(context, digest, &size);
+        return ToHex(digest, size);
+    }
+
+private:
+    EVP_MD_CTX* context;
+};
+
+// 파일을 읽을 수 없으면 ""
+string HashFile(const filesystem::path& filePath)
+{
+    ifstream file(filePath, ifstream::binary);
+    if (file.is_open() == false) return "";
+    Sha256 sha;
+    vector<char> buffer(256 * 1024);
+    while (file)
+    {
+        file.read(buffer.data(), static_cast<streamsize>(buffer.size()));
+        sha.Update(buffer.data(), static_cast<size_t>(file.gcount()));
+    }
+    return file.bad() ? "" : sha.GetHex();
+}
+
+// 이전 version 의 파일에서 새 파일을 만드는 delta (delta.h)
+struct ManifestDelta
+{
+    string BaseVersion; // 설치된 version 이 이것일 때만 쓴다.
+    string BaseSha256;
+    string Url;
+    uint64_t Size = 0;
+
+    JS_OBJ(BaseVersion, BaseSha256, Url, Size);
+};
+
+// 파일을 내용으로 나눈 조각 (chunk.h). 파일 안의 위치는 앞 chunk 들의 크기 합
+struct ManifestChunk
+{
+    string Id; // sha256
+    uint64_t Size = 0;
+
+    JS_OBJ(Id, Size);
+};
+
+// 설치될 파일 하나. package zip 의 어느 구간에 있는지도 기록해 파일 하나만 Range 로 받을 수 있게 한다.
+struct ManifestFile
+{
+    string Path; // utf-8, '/' separated
+    uint64_t Size = 0;
+    string Sha256;
+    string Url; // optional ; 있으면 package zip 대신 이 url 에서 파일 그대로 받는다.
+    uint64_t Offset = 0; // package zip 에서 압축 데이터의 위치
+    uint64_t CompressedSize = 0;
+    uint16_t Method = 0; // ZIP_METHOD_STORED, ZIP_METHOD_DEFLATED
+    uint32_t Crc32 = 0;
+    vector<ManifestDelta> Deltas; // optional
+    vector<ManifestChunk> Chunks; // optional ; Manifest::ChunkUrl 이 있을 때
+
+    JS_OBJ(Path, Size, Sha256, Url, Offset, CompressedSize, Method, Crc32, Deltas, Chunks);
+};
+
+struct Manifest
+{
+    vector<ManifestFile> Files;
+    string ChunkUrl; // optional ; chunk 는 ChunkUrl + Id 에서 받는다.
+
+    JS_OBJ(Files, ChunkUrl);
+
+    bool Load(const string& json)
+    {
+        return LoadFrom(*this, json);
+    }
+};
+
+// package zip 으로 manifest 를 만든다. (배포용)
+bool MakeManifest(const filesystem::path& zipFilePath, Manifest& outManifest)
+{
+    MappedFile mapped(zipFilePath);
+    if (mapped.IsValid() == false)
+    {
+        cerr << "file could not be opened. " << zipFilePath.u8string() << endl;
+        return false;
+    }
+    const auto data = static_cast<const uint8_t*>(mapped.GetData());
+
+    try
+    {
+        miniz_cpp::zip_file zip;
+        zip.load_view(mapped.GetData(), mapped.GetSize());
+        for (const auto& f : zip.infolist())
+        {
+            if (f.filename.back() == '/') continue; // directory
+
+            const auto& header = data + f.header_offset; // local file header
+            ManifestFile file;
+            file.Path = f.filename;
+            file.Size = f.file_size;
+            file.Offset = f.header_offset + 30 + ReadLE16(header + 26) + ReadLE16(header + 28);
+            file.CompressedSize = f.compress_size;
+            file.Method = ReadLE16(header + 8);
+            file.Crc32 = f.crc;
+            if (EntryDecoder::IsSupported(file.Method) == false || file.Offset + file.CompressedSize > mapped.GetSize())
+            {
+                cerr << "unsupported entry : " << f.filename << endl;
+                return false;
+            }
+
+            Sha256 sha;
+            EntryDecoder decoder(file.Method, file.CompressedSize, [&](const char* d, size_t size)
+            {
+                sha.Update(d, size);
+                return true;
+            });
+            if (decoder.Write(reinterpret_cast<const char*>(data + file.Offset), static_cast<size_t>(file.CompressedSize)) == false
+                || decoder.IsFinished() == false)
+            {
+                cerr << "could not read : " << f.filename << endl;
+                return false;
+            }
+            file.Sha256 = sha.GetHex();
+            outManifest.Files.push_back(move(file));
+        }
+    }
+    catch (const runtime_error& e)
+    {
+        cerr << e.what() << endl;
+        return false;
+    }
+    return true;
+}
+
+// package zip 에서 manifest 의 파일 하나를 메모리로 푼다.
+bool DecodeManifestFile(const MappedFile& zip, const ManifestFile& file, vector<char>& out)
+{
+    if (file.Offset + file.CompressedSize > zip.GetSize()) return false;
+    out.clear();
+    out.reserve(static_cast<size_t>(file.Size));
+    EntryDecoder decoder(file.Method, file.CompressedSize, [&](const char* data, size_t size)
+    {
+        out.insert(out.end(), data, data + size);
+        return true;
+    });
+    return decoder.Write(static_cast<const char*>(zip.GetData()) + file.Offset, static_cast<size_t>(file.CompressedSize))
+        && decoder.IsFinished();
+}
+
+// 이전 package 와 내용이 바뀐 파일마다 delta 를 만들어 package 옆 delta/ 에 쓰고 manifest 에 기록한다. (배포용)
+// delta 가 압축된 파일보다 작지 않으면 만들지 않는다.
+bool MakeDeltas(Manifest& manifest, const filesystem::path& zipFilePath, const filesystem::path& baseZipFilePath
+    , const string& baseVersion, const string& urlPrefix)
+{
+    Manifest baseManifest;
+    if (MakeManifest(baseZipFilePath, baseManifest) == false) return false;
+    map<string, const ManifestFile*> baseFiles;
+    for (const auto& f : baseManifest.Files) baseFiles[f.Path] = &f;
+
+    MappedFile zip(zipFilePath);
+    MappedFile baseZip(baseZipFilePath);
+    if (zip.IsValid() == false || baseZip.IsValid() == false) return false;
+
+    const auto& deltaDir = zipFilePath.parent_path() / "delta";
+    filesystem::create_directories(deltaDir);
+
+    size_t count = 0;
+    vector<char> target;
+    vector<char> base;
+    vector<uint8_t> delta;
+    for (auto& f : manifest.Files)
+    {
+        auto found = baseFiles.find(f.Path);
+        if (found == baseFiles.end() || found->second->Sha256 == f.Sha256) continue;
+        const auto& baseFile = *found->second;
+        if (DecodeManifestFile(zip, f, target) == false || DecodeManifestFile(baseZip, baseFile, base) == false)
+        {
+            cerr << "could not read : " << f.Path << endl;
+            return false;
+        }
+
+        MakeDelta(reinterpret_cast<const uint8_t*>(base.data()), base.size(), reinterpret_cast<const uint8_t*>(target.data()), target.size(), delta);
+        if (delta.size() >= f.CompressedSize) continue;
+
+        const auto& name = f.Sha256.substr(0, 16) + "-" + baseFile.Sha256.substr(0, 16) + ".delta";
+        ofstream out(deltaDir / name, ofstream::binary);
+        out.write(reinterpret_cast<const char*>(delta.data()), static_cast<streamsize>(delta.size()));
+        out.close();
+        if (out.fail())
+        {
+            cerr << "could not write a file : " << (deltaDir / name).u8string() << endl;
+            return false;
+        }
+
+        f.Deltas.erase(remove_if(f.Deltas.begin(), f.Deltas.end(), [&](const ManifestDelta& d) { return d.BaseVersion == baseVersion; }), f.Deltas.end());
+        f.Deltas.push_back({ baseVersion, baseFile.Sha256, urlPrefix + name, delta.size() });
+        cout << "delta " << f.Path << " : " << delta.size() << " bytes (compressed " << f.CompressedSize << ")" << endl;
+        ++count;
+    }
+    cout << count << " deltas from version " << baseVersion << endl;
+    return true;
+}
+
+// 모든 파일을 chunk 로 나누어 package 옆 chunks/ 에 쓰고 manifest 에 기록한다. (배포용)
+// 이미 있는 chunk 는 다시 쓰지 않으므로 여러 version 이 같은 chunks/ 를 나누어 쓸 수 있다.
+bool MakeChunks(Manifest& manifest, const filesystem::path& zipFilePath, const string& urlPrefix)
+{
+    MappedFile zip(zipFilePath);
+    if (zip.IsValid() == false) return false;
+
+    const auto& chunkDir = zipFilePath.parent_path() / "chunks";
+    filesystem::create_directories(chunkDir);
+
+    size_t count = 0;
+    size_t written = 0;
+    vector<char> data;
+    for (auto& f : manifest.Files)
+    {
+        if (DecodeManifestFile(zip, f, data) == false)
+        {
+            cerr << "could not read : " << f.Path << endl;
+            return false;
+        }
+        f.Chunks.clear();
+        const auto bytes = reinterpret_cast<const uint8_t*>(data.data());
+        for (size_t offset = 0; offset < data.size();)
+        {
+            const auto size = GetChunkSize(bytes + offset, data.size() - offset);
+            Sha256 sha;
+            sha.Update(bytes + offset, size);
+            f.Chunks.push_back({ sha.GetHex(), size });
+            ++count;
+
+            const auto& chunkPath = chunkDir / f.Chunks.back().Id;
+            if (filesystem::exists(chunkPath) == false)
+            {
+                ofstream out(chunkPath, ofstream::binary);
+                out.write(data.data() + offset, static_cast<streamsize>(size));
+                out.close();
+                if (out.fail())
+                {
+                    cerr << "could not write a file : " << chunkPath.u8string() << endl;
+                    return false;
+                }
+                ++written;
+            }
+            offset += size;
+        }
+    }
+    manifest.ChunkUrl = urlPrefix;
+    cout << count << " chunks, " << written << " new" << endl;
+    return true;
+}
+
+// chunk 들을 모아 파일을 만든다.
+// 이전 manifest 로 설치된 파일 안의 chunk 를 먼저 찾고, 다음은 cache 디렉토리, 마지막으로 서버에서 받는다.
+// 받은 chunk 는 cache 에 남겨 중간에 실패해도 다음에 다시 받지 않는다.
+class ChunkStore
+{
+public:
+    ChunkStore(const filesystem::path& cacheDir, const Manifest& oldManifest, const filesystem::path& installPath)
+        : cacheDir(cacheDir)
+    {
+        for (const auto& f : oldManifest.Files)
+        {
+            uint64_t offset = 0;
+            for (const auto& c : f.Chunks)
+            {
+                installed.emplace(c.Id, Location{ installPath / filesystem::u8path(f.Path), offset });
+                offset += c.Size;
+            }
+        }
+    }
+
+    // client 는 chunk 서버, chunkPath 는 Id 앞에 붙일 경로
+    bool Assemble(const ManifestFile& file, const filesystem::path& outPath, httplib::Client* client, const string& chunkPath)
+    {
+        ofstream out(outPath, ofstream::binary);
+        if (out.fail())
+        {
+            cerr << "could not write a file : " << outPath.u8string() << endl;
+            return false;
+        }
+        Sha256 sha;
+        vector<char> chunk;
+        for (const auto& c : file.Chunks)
+        {
+            if (ReadInstalled(c, chunk)) installedBytes += c.Size;
+            else if (ReadCached(c, chunk)) cachedBytes += c.Size;
+            else if (client && Download(c, *client, chunkPath, chunk)) downloadedBytes += c.Size;
+            else
+            {
+                cerr << "could not get a chunk " << c.Id << " : " << file.Path << endl;
+                return false;
+            }
+            sha.Update(chunk.data(), chunk.size());
+            out.write(chunk.data(), static_cast<streamsize>(chunk.size()));
+        }
+        out.close();
+        return out.good() && sha.GetHex() == file.Sha256;
+    }
+
+    // 모두 설치된 뒤에는 chunk 가 설치된 파일 안에 있으므로 cache 는 필요없다.
+    void Clear()
+    {
+        error_code ec;
+        filesystem::remove_all(cacheDir, ec);
+    }
+
+    void PrintStatistics() const
+    {
+        cout << "chunks : " << installedBytes << " bytes from installed files, " << cachedBytes << " bytes from cache, "
+            << downloadedBytes << " bytes downloaded" << endl;
+    }
+
+private:
+    struct Location
+    {
+        filesystem::path FilePath;
+        uint64_t Offset;
+    };
+
+    static bool IsValid(const ManifestChunk& chunk, const vector<char>& data)
+    {
+        if (data.size() != chunk.Size) return false;
+        Sha256 sha;
+        sha.Update(data.data(), data.size());
+        return sha.GetHex() == chunk.Id;
+    }
+
+    bool ReadInstalled(const ManifestChunk& chunk, vector<char>& data) const
+    {
+        auto found = installed.find(chunk.Id);
+        if (found == installed.end()) return false;
+        ifstream file(found->second.FilePath, ifstream::binary);
+        if (file.is_open() == false) return false;
+        data.resize(static_cast<size_t>(chunk.Size));
+        file.seekg(static_cast<streamoff>(found->second.Offset));
+        file.read(data.data(), static_cast<streamsize>(data.size()));
+        return file.good() && IsValid(chunk, data); // 설치된 파일이 manifest 와 다를 수 있다.
+    }
+
+    bool ReadCached(const ManifestChunk& chunk, vector<char>& data) const
+    {
+        ifstream file(cacheDir / chunk.Id, ifstream::binary);
+        if (file.is_open() == false) return false;
+        data.resize(static_cast<size_t>(chunk.Size));
+        file.read(data.data(), static_cast<streamsize>(data.size()));
+        return file.good() && IsValid(chunk, data);
+    }
+
+    bool Download(const ManifestChunk& chunk, httplib::Client& client, const string& chunkPath, vector<char>& data)
+    {
+        data.clear();
+        auto res = ClientPool::GetInstance().Send(client, [&](httplib::ResponseHandler handler)
+        {
+            return client.Get((chunkPath + chunk.Id).c_str(), httplib::Headers(), handler,
+                [&](const char* d, size_t length)
+                {
+                    data.insert(data.end(), d, d + length);
+                    return data.size() <= chunk.Size;
+                });
+        },
+        [](const httplib::Response& response) { return response.status == 200; });
+        if (res.error() != httplib::Error::Success || res->status != 200) return false;
+        if (IsValid(chunk, data) == false) return false;
+
+        // cache ; 실패해도 상관없다.
+        error_code ec;
+        filesystem::create_directories(cacheDir, ec);
+        auto tmpPath = cacheDir / chunk.Id;
+        tmpPath += ".tmp";
+        {
+            ofstream out(tmpPath, ofstream::binary);
+            out.write(data.data(), static_cast<streamsize>(data.size()));
+        }
+        filesystem::rename(tmpPath, cacheDir / chunk.Id, ec);
+        return true;
+    }
+
+    filesystem::path cacheDir;
+    unordered_map<string, Location> installed;
+    atomic<uint64_t> installedBytes{ 0 };
+    atomic<uint64_t> cachedBytes{ 0 };
+    atomic<uint64_t> downloadedBytes{ 0 };
+};
+
+// 설치된 파일에 delta 를 적용해 tmpPath 에 쓴다. 결과의 hash 가 맞지 않으면 false
+bool ApplyManifestDelta(const ManifestFile& file, const ManifestDelta& delta, const filesystem::path& target, const filesystem::path& tmpPath)
+{
+    auto deltaPath = tmpPath;
+    deltaPath += ".delta";
+    if (Download(delta.Url, deltaPath.u8string()) == false) return false;
+
+    bool applied = false;
+    {
+        MappedFile base(target);
+        MappedFile deltaFile(deltaPath);
+        ofstream out(tmpPath, ofstream::binary);
+        if (base.IsValid() && deltaFile.IsValid() && out.is_open())
+        {
+            Sha256 sha;
+            applied = ApplyDelta(static_cast<const uint8_t*>(base.GetData()), base.GetSize()
+                , static_cast<const uint8_t*>(deltaFile.GetData()), deltaFile.GetSize(), [&](const char* data, size_t size)
+            {
+                sha.Update(data, size);
+                out.write(data, static_cast<streamsize>(size));
+                return out.good();
+            });
+            out.close();
+            applied = applied && out.good() && sha.GetHex() == file.Sha256;
+        }
+    }
+    filesystem::remove(deltaPath);
+    if (applied == false) filesystem::remove(tmpPath);
+    return applied;
+}
+
+// 새 manifest 에서 설치 경로와 다른 파일들을 고른다.
+// 크기가 맞는 파일은 설치된 파일의 hash 를 비교한다. (이전 manifest 는 설치된 파일과 다를 수 있으므로 믿지 않는다)
+// hash 는 index 에 기록된 뒤로 바뀌지 않았으면 기록된 것을 쓰고, 아니면 계산해 기록한다.
+vector<const ManifestFile*> PlanManifestPatch(const Manifest& newManifest, const filesystem::path& installPath, FileStateIndex& index)
+{
+    Metrics::Phase phase("plan");
+    phase.Add(0, newManifest.Files.size());
+
+    vector<const ManifestFile*> changed;
+    for (const auto& f : newManifest.Files)
+    {
+        error_code ec;
+        auto size = filesystem::file_size(installPath / filesystem::u8path(f.Path), ec);
+        if (ec || size != f.Size)
+        {
+            changed.push_back(&f);
+            continue;
+        }
+
+        const auto& target = installPath / filesystem::u8path(f.Path);
+        string sha;
+        if (index.GetSha256(target, sha) == false)
+        {
+            phase.Add(size); // hash 를 계산한 byte
+            sha = HashFile(target);
+            if (sha.empty() == false) index.SetSha256(target, sha);
+        }
+        if (sha != f.Sha256) changed.push_back(&f);
+    }
+    return changed;
+}
+
+filesystem::path GetPatchPath(const filesystem::path& target)
+{
+    auto tmpPath = target;
+    tmpPath += ".patch";
+    return tmpPath;
+}
+
+// 파일 하나를 받아 hash 를 확인하고 <파일>.patch 에 쓴다.
+// 설치된 version(baseVersion) 에서 만든 delta 가 있으면 먼저 적용해 보고, 다음은 chunk 로 모아 보고, 안 되면 파일 전체를 받는다.
+// Url 이 없으면 package zip 의 압축 데이터 구간만 받아 푼다. (packageClient 는 package zip 의 서버, 없으면 range 를 쓸 수 없다)
+// <파일>.patch 는 outputPath 아래에 쓴다. delta 의 base 는 installPath 의 파일
+bool FetchManifestFile(const ManifestFile& file, const string& baseVersion, ChunkStore& chunks, httplib::Client* chunkClient, const string& chunkPath
+    , httplib::Client* packageClient, const string& packagePath, const httplib::Headers& packageHeaders, const filesystem::path& installPath
+    , const filesystem::path& outputPath)
+{
+    const auto& target = installPath / filesystem::u8path(file.Path);
+    const auto& tmpPath = GetPatchPath(outputPath / filesystem::u8path(file.Path));
+    if (tmpPath.has_parent_path()) filesystem::create_directories(tmpPath.parent_path());
+
+    const auto& delta = find_if(file.Deltas.begin(), file.Deltas.end(), [&](const ManifestDelta& d) { return d.BaseVersion == baseVersion; });
+    if (baseVersion.empty() == false && delta != file.Deltas.end() && filesystem::exists(target)
+        && ApplyManifestDelta(file, *delta, target, tmpPath))
+    {
+        return true;
+    }
+    if (file.Chunks.empty() == false && chunks.Assemble(file, tmpPath, chunkClient, chunkPath)) return true;
+
+    if (file.Url.empty() == false)
+    {
+        if (Download(file.Url, tmpPath.u8string()) == false) return false;
+        if (HashFile(tmpPath) != file.Sha256)
+        {
+            cerr << "hash mismatch : " << file.Path << endl;
+            filesystem::remove(tmpPath);
+            return false;
+        }
+    }
+    else
+    {
+        if (packageClient == nullptr) return false;
+        ofstream out(tmpPath, ofstream::binary);
+        if (out.fail())
+        {
+            cerr << "could not write a file : " << tmpPath.u8string() << endl;
+            return false;
+        }
+        Sha256 sha;
+        EntryDecoder decoder(file.Method, file.CompressedSize, [&](const char* data, size_t size)
+        {
+            sha.Update(data, size);
+            out.write(data, static_cast<streamsize>(size));
+            return out.good();
+        });
+        if (file.CompressedSize > 0)
+        {
+            auto headers = packageHeaders;
+            headers.insert(MakeRangeHeader(file.Offset, file.Offset + file.CompressedSize - 1));
+            auto res = ClientPool::GetInstance().Send(*packageClient, [&](httplib::ResponseHandler handler)
+            {
+                return packageClient->Get(packagePath.c_str(), headers, handler, [&](const char* data, size_t length) { return decoder.Write(data, length); });
+            },
+            [](const httplib::Response& response) { return response.status == 206; });
+            if (res.error() != httplib::Error::Success)
+            {
+                cerr << "http client error(" << res.error() << ") : " << file.Path << endl;
+                return false;
+            }
+        }
+        out.close();
+        if (out.fail() || decoder.IsFinished() == false || sha.GetHex() != file.Sha256)
+        {
+            cerr << "hash mismatch : " << file.Path << endl;
+            filesystem::remove(tmpPath);
+            return false;
+        }
+    }
+    return true;
+}
+
+// newManifest 의 파일들(changed) 을 connections 개의 연결로 나누어 받는다.
+// 모두 받은 뒤에 한꺼번에 바꾸므로 받는 동안에는 설치된 파일(oldManifest) 을 chunk 의 원본으로 쓸 수 있다.
+// 받은 파일은 outputPath 에 쓴다. installPath 와 다르면 설치된 파일은 그대로 남는다. (staging)
+bool ReplaceManifestFiles(const vector<const ManifestFile*>& changed, const Manifest& newManifest, const Manifest& oldManifest
+    , const string& oldVersion, const string& packageUrl, const filesystem::path& installPath, const filesystem::path& outputPath
+    , const filesystem::path& chunkCacheDir, size_t connections, FileStateIndex& index)
+{
+    RangeProbe probe;
+    auto needsPackage = any_of(changed.begin(), changed.end(), [](const ManifestFile* f) { return f->Url.empty(); });
+    if (needsPackage)
+    {
+        if (ProbeRange(packageUrl, probe) == false) return false;
+        if (probe.AcceptRanges == false)
+        {
+            cout << "package server does not support range requests : " << packageUrl << endl;
+            needsPackage = false;
+        }
+    }
+    const auto serverAddress = probe.Url.substr(0, GetPathSepIndex(probe.Url));
+    const auto path = probe.Url.substr(serverAddress.size());
+    auto headers = httplib::Headers();
+    if (probe.Cookies.empty() == false) headers.insert({ "Cookie", MakeCookieValue(probe.Cookies) });
+    if (probe.ETag.empty() == false) headers.insert({ "If-Range", probe.ETag });
+
+    Metrics::Phase fetchPhase("fetch");
+    ChunkStore chunks(chunkCacheDir, oldManifest, installPath);
+    const auto chunkServerAddress = newManifest.ChunkUrl.substr(0, GetPathSepIndex(newManifest.ChunkUrl));
+    const auto chunkPath = newManifest.ChunkUrl.substr(chunkServerAddress.size());
+
+    atomic<size_t> next(0);
+    atomic<bool> failed(false);
+    mutex outputLock;
+    auto fetch = [&]()
+    {
+        ClientPool::Lease client;
+        if (needsPackage) client = ClientPool::GetInstance().Acquire(serverAddress);
+        ClientPool::Lease chunkClient;
+        if (newManifest.ChunkUrl.empty() == false) chunkClient = ClientPool::GetInstance().Acquire(chunkServerAddress);
+        for (size_t i; failed == false && (i = next++) < changed.size();)
+        {
+            if (FetchManifestFile(*changed[i], oldVersion, chunks, chunkClient.Get(), chunkPath, client.Get(), path, headers, installPath, outputPath) == false)
+            {
+                failed = true;
+                break;
+            }
+            lock_guard<mutex> lock(outputLock);
+            cout << "fetched " << changed[i]->Path << endl;
+        }
+    };
+    vector<thread> workers;
+    for (size_t i = 1; i < min(max<size_t>(connections, 1), changed.size()); ++i) workers.emplace_back(fetch);
+    fetch();
+    for (auto& w : workers) w.join();
+    for (const auto& f : changed) fetchPhase.Add(failed ? 0 : f->Size, failed ? 0 : 1);
+    fetchPhase.End();
+    if (newManifest.ChunkUrl.empty() == false) chunks.PrintStatistics();
+    if (failed)
+    {
+        for (const auto& f : changed)
+        {
+            error_code ec;
+            filesystem::remove(GetPatchPath(outputPath / filesystem::u8path(f->Path)), ec);
+        }
+        return false;
+    }
+
+    Metrics::Phase renamePhase("rename");
+    for (const auto& f : changed)
+    {
+        renamePhase.Add(0, 1);
+        const auto& target = outputPath / filesystem::u8path(f->Path);
+        error_code ec;
+        filesystem::rename(GetPatchPath(target), target, ec);
+        if (ec)
+        {
+            cerr << "could not rename a file(" << ec.message() << ") : " << GetPatchPath(target).u8string() << endl;
+            return false;
+        }
+        index.SetSha256(target, f->Sha256);
+        index.SetCrc32(target, f->Crc32);
+        cout << "patched " << f->Path << endl;
+    }
+    chunks.Clear();
+    return true;
+}
+
+// manifest 를 비교해 바뀐 파일만 받는다. 이전 manifest 에만 있는 파일은 지운다.
+// deferredRemovals 가 있으면 지우지 않고 목록에 담는다. (받은 파일은 outputPath 에 있으므로 나중에 함께 적용)
+bool PatchByManifest(const Manifest& newManifest, const Manifest& oldManifest, const string& oldVersion, const string& packageUrl
+    , const filesystem::path& installPath, const filesystem::path& outputPath, const filesystem::path& chunkCacheDir, size_t connections
+    , FileStateIndex& index, vector<string>* deferredRemovals = nullptr)
+{
+    const auto& changed = PlanManifestPatch(newManifest, installPath, index);
+    uint64_t changedSize = 0;
+    for (const auto& f : changed) changedSize += f->Size;
+    cout << changed.size() << " of " << newManifest.Files.size() << " files changed (" << changedSize << " bytes)" << endl;
+
+    if (ReplaceManifestFiles(changed, newManifest, oldManifest, oldVersion, packageUrl, installPath, outputPath, chunkCacheDir
+        , connections, index) == false)
+    {
+        return false;
+    }
+
+    set<string> newFiles;
+    for (const auto& f : newManifest.Files) newFiles.insert(f.Path);
+    for (const auto& f : oldManifest.Files)
+    {
+        if (newFiles.count(f.Path)) continue;
+        if (deferredRemovals)
+        {
+            deferredRemovals->push_back(f.Path);
+            continue;
+        }
+        error_code ec;
+        if (filesystem::remove(installPath / filesystem::u8path(f.Path), ec)) cout << "removed " << f.Path << endl;
+        index.Remove(installPath / filesystem::u8path(f.Path));
+    }
+    return true;
+}
+
+// 받은 update 를 모아 두는 곳. 설치된 파일은 모두 받은 뒤에 Apply 로 한꺼번에 바꾼다.
+// (background 로 받았으면 실행 중인 앱의 파일은 바꿀 수 없으므로 다음 실행 때 적용한다)
+//   files/   새로 쓴 파일들 (설치 경로 기준) ; version file 들도 여기에 둔다.
+//   removed  지울 파일 목록 (한 줄에 하나)
+//   target   받고 있는 version ; 다르면 처음부터 다시 받는다.
+//   ready    모두 받은 뒤 마지막에 쓴다. 없으면 적용하지 않는다.
+class StagedUpdate
+{
+public:
+    StagedUpdate(const filesystem::path& stagingPath)
+        : stagingPath(stagingPath)
+    {
+    }
+
+    filesystem::path GetPath(const string& name) const { return stagingPath / filesystem::u8path(name); }
+    filesystem::path GetFilesPath() const { return GetPath(FILES_NAME); }
+    bool IsReady() const { return filesystem::exists(GetPath(READY_NAME)); }
+
+    // version 을 받을 준비. 같은 version 을 받다 멈췄으면 이어서 받고, 아니면 지우고 새로 시작한다.
+    bool Begin(const string& version)
+    {
+        error_code ec;
+        if (filesystem::exists(GetPath(TARGET_NAME)) == false || ReadTextFrom(GetPath(TARGET_NAME).u8string()) != version)
+        {
+            filesystem::remove_all(stagingPath, ec);
+        }
+        filesystem::create_directories(GetFilesPath(), ec);
+        if (ec)
+        {
+            cerr << "could not create a directory(" << ec.message() << ") : " << GetFilesPath().u8string() << endl;
+            return false;
+        }
+        return WriteTextTo(GetPath(TARGET_NAME).u8string(), version);
+    }
+
+    bool SetRemoved(const vector<string>& paths)
+    {
+        return WriteList(GetPath(REMOVED_NAME), paths);
+    }
+
+    bool MarkReady()
+    {
+        return WriteTextTo(GetPath(READY_NAME).u8string(), "");
+    }
+
+    void Clear()
+    {
+        error_code ec;
+        filesystem::remove_all(stagingPath, ec);
+    }
+
+    // 파일들을 설치 경로로 옮기고 지울 파일을 지운 뒤 versionFiles 를 순서대로 옮긴다. (마지막이 version file)
+    // 파일 하나마다 rename 두 번 ; 설치된 파일은 지우지 않고 undo/ 로 옮겨 두었다가 끝나면 previousPath 로 옮긴다.
+    // previousPath 는 그 자체로 이전 version 으로 되돌리는 update 가 된다. (--rollback)
+    // 옮기다 실패하면 이번에 옮긴 것을 거꾸로 되돌린다. 중간에 종료되면 ready 가 남아 다음 실행 때 남은 것부터 다시 적용한다.
+    // outApplied 에는 적용한 파일들(version file 제외)
+    bool Apply(const filesystem::path& installPath, const vector<string>& versionFiles, FileStateIndex& index, const filesystem::path& previousPath
+        , vector<string>* outApplied = nullptr)
+    {
+        if (versionFiles.empty())
+        { // 마지막에 옮길 version file 이 없으면 적용이 끝났는지 알 수 없다.
+            cerr << "no version file to apply the staged update with" << endl;
+            return false;
+        }
+        Metrics::Phase phase("rename");
+        const auto& filesPath = GetFilesPath();
+        const auto& undoPath = GetPath(UNDO_NAME);
+
+        // 적용할 목록은 처음 한 번만 기록한다. 다시 적용할 때는 이미 옮긴 파일이 files/ 에 없다.
+        vector<string> staged;
+        if (filesystem::exists(GetPath(APPLYING_NAME))) staged = ReadList(GetPath(APPLYING_NAME));
+        error_code ec;
+        for (auto i = filesystem::recursive_directory_iterator(filesPath, ec); !ec && i != filesystem::recursive_directory_iterator(); i.increment(ec))
+        {
+            const auto& path = i->path().lexically_relative(filesPath);
+            error_code dirEc;
+            if (i->is_directory()) filesystem::create_directories(installPath / path, dirEc);
+            else if (filesystem::exists(GetPath(APPLYING_NAME)) == false) staged.push_back(path.generic_u8string());
+        }
+        if (filesystem::exists(GetPath(APPLYING_NAME)) == false && WriteList(GetPath(APPLYING_NAME), staged) == false) return false;
+
+        vector<pair<filesystem::path, filesystem::path>> moved; // 이번에 옮긴 것 (from, to)
+        auto moveFile = [&](const filesystem::path& from, const filesystem::path& to)
+        {
+            if (to.has_parent_path()) filesystem::create_directories(to.parent_path(), ec);
+            if (Move(from, to, index) == false) return false;
+            moved.emplace_back(from, to);
+            return true;
+        };
+        auto replace = [&](const filesystem::path& from, const filesystem::path& target, const filesystem::path& undo)
+        {
+            if (filesystem::exists(target) && moveFile(target, undo) == false) return false;
+            return from.empty() || moveFile(from, target);
+        };
+
+        auto replaceStaged = [&](const string& path)
+        {
+            const auto& from = filesPath / filesystem::u8path(path);
+            if (filesystem::exists(from) == false) return true; // 이미 옮겼다.
+            return replace(from, installPath / filesystem::u8path(path), undoPath / FILES_NAME / filesystem::u8path(path));
+        };
+
+        bool replaced = true;
+        for (size_t i = 0; replaced && i < staged.size(); ++i)
+        {
+            if (find(versionFiles.begin(), versionFiles.end(), staged[i]) != versionFiles.end()) continue;
+            replaced = replaceStaged(staged[i]);
+        }
+        const auto& removed = filesystem::exists(GetPath(REMOVED_NAME)) ? ReadList(GetPath(REMOVED_NAME)) : vector<string>();
+        for (size_t i = 0; replaced && i < removed.size(); ++i)
+        {
+            const auto& target = installPath / filesystem::u8path(removed[i]);
+            if (filesystem::exists(target) == false) continue;
+            replaced = replace(filesystem::path(), target, undoPath / FILES_NAME / filesystem::u8path(removed[i]));
+            if (replaced) cout << "removed " << removed[i] << endl;
+        }
+        for (size_t i = 0; replaced && i < versionFiles.size(); ++i) replaced = replaceStaged(versionFiles[i]);
+        if (replaced == false)
+        {
+            for (auto m = moved.rbegin(); m != moved.rend(); ++m) Move(m->second, m->first, index);
+            cerr << "could not apply the staged update, " << moved.size() << " moves are rolled back" << endl;
+            return false;
+        }
 
-        for (const auto& f : zip.infolist())
+        // 되돌릴 때는 이번에 새로 생긴 파일을 지운다. 설치된 version file 이 없었으면 되돌릴 곳도 없다.
+        vector<string> added;
+        for (const auto& path : staged)
         {
-            if (!slicent) cout << "extracting " << f.filename << " ... ";
-            if (f.filename.back() == '/') // directory
+            if (filesystem::exists(undoPath / FILES_NAME / filesystem::u8path(path)) == false) added.push_back(path);
+        }
+        filesystem::create_directories(undoPath, ec);
+        bool canRollback = WriteList(undoPath / REMOVED_NAME, added) && filesystem::exists(undoPath / FILES_NAME / filesystem::u8path(versionFiles.back()))
+            && WriteTextTo((undoPath / READY_NAME).u8string(), "");
+
+        if (outApplied)
+        {
+            for (const auto& path : staged)
             {
-                const auto& target = dest / f.filename;
-                if (filesystem::exists(target))
-                {
-                    if (!slicent) cout << "exists" << endl;
-                    continue;
-                }
-                filesystem::create_directories(target); // 모든 상위 directory 를 생성하지 못하는 경우,
-                                                     // 실제 directory 를 올바르게 생성했다 하더라도 false 를 return 할 수 있음.
-                if (!slicent) cout << "created" << endl;
-                continue;
+                if (find(versionFiles.begin(), versionFiles.end(), path) == versionFiles.end()) outApplied->push_back(path);
             }
-            zip.extract(f, dest.u8string());
-            if (!slicent) cout << "done" << endl;
         }
+
+        filesystem::remove(GetPath(READY_NAME), ec); // 여기부터는 다시 적용하지 않는다.
+        filesystem::remove_all(previousPath, ec);
+        if (canRollback) filesystem::rename(undoPath, previousPath, ec);
+        Clear();
+        phase.Add(0, staged.size());
+        cout << staged.size() << " staged files applied" << endl;
+        return true;
     }
-    catch (const runtime_error& e)
+
+private:
+    static bool Move(const filesystem::path& from, const filesystem::path& to, FileStateIndex& index)
     {
-        cerr << e.what() << endl;
-        return false;
+        error_code ec;
+        filesystem::rename(from, to, ec);
+        if (ec)
+        {
+            cerr << "could not rename a file(" << ec.message() << ") : " << from.u8string() << endl;
+            return false;
+        }
+        index.Move(from, to);
+        return true;
     }
-    return true;
-}
 
-bool ExtractZipToSourceDir(const string& sourceFilePath, bool slicent = false)
+    static vector<string> ReadList(const filesystem::path& filePath)
+    {
+        stringstream text(ReadTextFrom(filePath.u8string()));
+        vector<string> list;
+        for (string line; getline(text, line);)
+        {
+            if (line.empty() == false) list.push_back(line);
+        }
+        return list;
+    }
+
+    static bool WriteList(const filesystem::path& filePath, const vector<string>& list)
+    {
+        stringstream text;
+        for (const auto& line : list) text << line << '\n';
+        return WriteTextTo(filePath.u8string(), text.str());
+    }
+
+    const string FILES_NAME = u8"files";
+    const string REMOVED_NAME = u8"removed";
+    const string TARGET_NAME = u8"target";
+    const string READY_NAME = u8"ready";
+    const string APPLYING_NAME = u8"applying"; // Apply 를 시작할 때 files/ 에 있던 파일들
+    const string UNDO_NAME = u8"undo"; // Apply 가 밀어낸 설치된 파일들
+
+    filesystem::path stagingPath;
+};
+
+class Semaphore
+{
+public:
+    explicit Semaphore(size_t count) : count(max<size_t>(count, 1)) {}
+
+    void Acquire()
+    {
+        unique_lock<mutex> lock(countLock);
+        released.wait(lock, [this]() { return count > 0; });
+        --count;
+    }
+
+    void Release()
+    {
+        {
+            lock_guard<mutex> lock(countLock);
+            ++count;
+        }
+        released.notify_one();
+    }
+
+private:
+    mutex countLock;
+    condition_variable released;
+    size_t count;
+};
+
+const size_t VERIFY_READ_SIZE = 1024 * 1024;
+
+// 설치된 파일들을 manifest 와 비교해 다른 파일들을 돌려준다.
+// 읽기는 동시에 ioDepth 개까지(HDD 는 1 이 좋다), hash 계산은 jobs 개까지 하므로 한 thread 가 hash 를 계산하는 동안 다른 thread 가 읽는다.
+// 크기가 같으면 모두 hash 를 계산한다. (index 를 믿지 않는다) 계산한 hash 는 index 에 기록한다.
+vector<const ManifestFile*> VerifyManifestFiles(const Manifest& manifest, const filesystem::path& installPath, size_t jobs, size_t ioDepth
+    , FileStateIndex& index)
 {
-    if (filesystem::exists(sourceFilePath) == false) return false; // not exist
+    Semaphore ioSlots(ioDepth);
+    Semaphore hashSlots(jobs);
+    atomic<size_t> next(0);
+    atomic<uint64_t> verifiedBytes(0);
+    mutex resultLock;
+    vector<const ManifestFile*> broken;
+    auto report = [&](const ManifestFile& file, const char* reason)
+    {
+        lock_guard<mutex> lock(resultLock);
+        cout << "broken " << file.Path << " (" << reason << ")" << endl;
+        broken.push_back(&file);
+    };
+
+    auto verify = [&]()
+    {
+        vector<char> buffer(VERIFY_READ_SIZE);
+        for (size_t i; (i = next++) < manifest.Files.size();)
+        {
+            const auto& file = manifest.Files[i];
+            const auto& target = installPath / filesystem::u8path(file.Path);
+            error_code ec;
+            auto size = filesystem::file_size(target, ec);
+            if (ec)
+            {
+                report(file, "missing");
+                continue;
+            }
+            if (size != file.Size)
+            {
+                report(file, "size");
+                continue;
+            }
+
+            ifstream stream;
+            OpenFile(stream, target, ifstream::binary, nullptr, 0); // 읽는 단위가 크므로 stream 의 buffer 는 쓰지 않는다.
+            Sha256 sha;
+            uint32_t crc = 0;
+            while (stream)
+            {
+                ioSlots.Acquire();
+                stream.read(buffer.data(), static_cast<streamsize>(buffer.size()));
+                ioSlots.Release();
+                const auto length = static_cast<size_t>(stream.gcount());
+                hashSlots.Acquire();
+                sha.Update(buffer.data(), length);
+                crc = Crc32(crc, buffer.data(), length);
+                hashSlots.Release();
+                verifiedBytes += length;
+            }
+            if (stream.bad() || stream.is_open() == false)
+            {
+                report(file, "unreadable");
+                continue;
+            }
+            stream.close();
+            const auto& hash = sha.GetHex();
+            index.SetSha256(target, hash);
+            index.SetCrc32(target, crc);
+            if (hash != file.Sha256) report(file, "hash");
+        }
+    };
+
+    const auto begin = chrono::steady_clock::now();
+    Metrics::Phase phase("verify");
+    vector<thread> workers;
+    for (size_t i = 1; i < min(max(jobs, ioDepth), manifest.Files.size()); ++i) workers.emplace_back(verify);
+    verify();
+    for (auto& w : workers) w.join();
+    chrono::duration<double> elapsed = chrono::steady_clock::now() - begin;
+    phase.Add(verifiedBytes, manifest.Files.size());
 
-    const auto& zipFilePath = filesystem::path(sourceFilePath);
-    const auto& workingPath = zipFilePath.parent_path();
-    return ExtractZip(zipFilePath, workingPath, slicent);
+    cout << "verified " << manifest.Files.size() << " files (" << verifiedBytes << " bytes) in " << elapsed.count() << " s, "
+        << broken.size() << " broken" << endl;
+    return broken;
 }
 
 string ReadFirstLine(const string& filePath)
@@ -300,8 +3166,13 @@ struct VersionInfo
     string Version;
     string ZipFileUrl;
     string ExecutePath;
+    string ManifestUrl; // optional ; 있으면 바뀐 파일만 받는다.
+    vector<string> Arguments; // optional ; ExecutePath 에 그대로 넘긴다. (shell 을 거치지 않으므로 따옴표가 필요 없다)
+    unordered_map<string, string> Environment; // optional ; 지금 환경 변수에 덮어쓴다.
+    string WorkingDirectory; // optional ; 설치 경로 기준, 없으면 설치 경로
+    vector<string> Prefetch; // optional ; 실행하자마자 읽는 파일(directory 면 그 아래 모두). 없으면 이번에 바뀐 파일들
 
-    JS_OBJ(Version, ZipFileUrl, ExecutePath);
+    JS_OBJ(Version, ZipFileUrl, ExecutePath, ManifestUrl, Arguments, Environment, WorkingDirectory, Prefetch);
 
     bool Load(const string& json)
     {
@@ -309,6 +3180,293 @@ struct VersionInfo
     }
 };
 
+// shell 을 거치지 않고 바로 실행한 process
+class Process
+{
+public:
+    Process() = default;
+
+    ~Process()
+    {
+#ifdef _WIN32
+        if (handle) CloseHandle(handle);
+#endif
+    }
+
+    Process(const Process&) = delete;
+    Process& operator=(const Process&) = delete;
+
+    // 경로는 모두 절대 경로 ; workingDirectory 가 비어 있으면 지금 directory
+    bool Start(const filesystem::path& executePath, const vector<string>& arguments, const unordered_map<string, string>& environment
+        , const filesystem::path& workingDirectory)
+    {
+#ifdef _WIN32
+        auto commandLine = Quote(executePath.wstring());
+        for (const auto& a : arguments) commandLine += L' ' + Quote(ToWide(a));
+
+        wstring environmentBlock; // "NAME=VALUE\0...\0\0"
+        if (environment.empty() == false)
+        {
+            auto current = GetEnvironmentStringsW();
+            for (auto entry = current; entry && *entry; entry += wcslen(entry) + 1)
+            {
+                const auto nameLength = wcscspn(entry + 1, L"=") + 1; // "=C:=C:\" 처럼 = 로 시작하는 것도 있다.
+                auto overridden = any_of(environment.begin(), environment.end(), [&](const pair<const string, string>& e)
+                {
+                    const auto& name = ToWide(e.first);
+                    return name.size() == nameLength && _wcsnicmp(name.c_str(), entry, nameLength) == 0;
+                });
+                if (overridden == false) environmentBlock.append(entry, wcslen(entry) + 1);
+            }
+            if (current) FreeEnvironmentStringsW(current);
+            for (const auto& e : environment) environmentBlock += ToWide(e.first) + L'=' + ToWide(e.second) + L'\0';
+            environmentBlock += L'\0';
+        }
+
+        STARTUPINFOW startupInfo = {};
+        startupInfo.cb = sizeof(startupInfo);
+        PROCESS_INFORMATION processInfo = {};
+        // start 처럼 console program 은 새 console 에서 실행한다.
+        if (CreateProcessW(executePath.c_str(), &commandLine[0], nullptr, nullptr, FALSE, CREATE_NEW_CONSOLE | CREATE_UNICODE_ENVIRONMENT
+            , environmentBlock.empty() ? nullptr : &environmentBlock[0], workingDirectory.empty() ? nullptr : workingDirectory.c_str()
+            , &startupInfo, &processInfo) == FALSE)
+        {
+            cerr << "could not start a process(" << GetLastError() << ") : " << executePath.u8string() << endl;
+            return false;
+        }
+        CloseHandle(processInfo.hThread);
+        handle = processInfo.hProcess;
+        id = processInfo.dwProcessId;
+        return true;
+#else
+        vector<string> argumentStrings{ executePath.string() };
+        argumentStrings.insert(argumentStrings.end(), arguments.begin(), arguments.end());
+        vector<string> environmentStrings;
+        for (auto entry = environ; *entry; ++entry)
+        {
+            const string e(*entry);
+            if (environment.count(e.substr(0, e.find('='))) == 0) environmentStrings.push_back(e);
+        }
+        for (const auto& e : environment) environmentStrings.push_back(e.first + '=' + e.second);
+        auto toPointers = [](vector<string>& strings)
+        {
+            vector<char*> pointers;
+            for (auto& s : strings) pointers.push_back(&s[0]);
+            pointers.push_back(nullptr);
+            return pointers;
+        };
+        auto argv = toPointers(argumentStrings);
+        auto envp = toPointers(environmentStrings);
+
+        pid_t pid = 0;
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 29))
+        posix_spawn_file_actions_t actions;
+        posix_spawn_file_actions_init(&actions);
+        if (workingDirectory.empty() == false) posix_spawn_file_actions_addchdir_np(&actions, workingDirectory.c_str());
+        posix_spawnattr_t attributes;
+        posix_spawnattr_init(&attributes);
+        posix_spawnattr_setflags(&attributes, POSIX_SPAWN_SETSID); // start 처럼 patcher 의 terminal 과 떼어 놓는다.
+        auto result = posix_spawn(&pid, executePath.c_str(), &actions, &attributes, argv.data(), envp.data());
+        posix_spawnattr_destroy(&attributes);
+        posix_spawn_file_actions_destroy(&actions);
+#else // working directory 를 바꿀 수 없는 posix_spawn
+        int result = 0;
+        pid = fork();
+        if (pid == 0)
+        {
+            setsid();
+            if (workingDirectory.empty() == false && chdir(workingDirectory.c_str()) != 0) _exit(127);
+            execve(executePath.c_str(), argv.data(), envp.data());
+            _exit(127);
+        }
+        if (pid < 0) result = errno;
+#endif
+        if (result != 0)
+        {
+            cerr << "could not start a process(" << strerror(result) << ") : " << executePath.u8string() << endl;
+            return false;
+        }
+        this->pid = pid;
+        id = static_cast<uint64_t>(pid);
+        return true;
+#endif
+    }
+
+    uint64_t GetId() const { return id; }
+
+    // 첫 입력을 받을 수 있게 될 때까지(첫 화면) 기다린다. windows 의 GUI program 만 알 수 있고, 그 밖에는 false
+    bool WaitForReady()
+    {
+#ifdef _WIN32
+        return handle && WaitForInputIdle(handle, INFINITE) == 0;
+#else
+        return false;
+#endif
+    }
+
+    // 끝날 때까지 기다려 exit code 를 돌려준다. 실패하면 -1
+    int Wait()
+    {
+#ifdef _WIN32
+        DWORD exitCode = 0;
+        if (handle == nullptr || WaitForSingleObject(handle, INFINITE) != WAIT_OBJECT_0 || GetExitCodeProcess(handle, &exitCode) == FALSE) return -1;
+        return static_cast<int>(exitCode);
+#else
+        int status = 0;
+        if (pid <= 0 || waitpid(pid, &status, 0) != pid) return -1;
+        return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+#endif
+    }
+
+private:
+#ifdef _WIN32
+    static wstring ToWide(const string& text)
+    {
+        if (text.empty()) return wstring();
+        wstring wide(MultiByteToWideChar(CP_UTF8, 0, text.data(), static_cast<int>(text.size()), nullptr, 0), L'\0');
+        MultiByteToWideChar(CP_UTF8, 0, text.data(), static_cast<int>(text.size()), &wide[0], static_cast<int>(wide.size()));
+        return wide;
+    }
+
+    // CommandLineToArgvW 가 다시 같은 인자로 나누도록 따옴표와 \ 를 붙인다.
+    static wstring Quote(const wstring& argument)
+    {
+        if (argument.empty() == false && argument.find_first_of(L" \t\n\v\"") == wstring::npos) return argument;
+        wstring quoted(1, L'"');
+        for (auto i = argument.begin();; ++i)
+        {
+            size_t backslashes = 0;
+            for (; i != argument.end() && *i == L'\\'; ++i) ++backslashes;
+            if (i == argument.end())
+            {
+                quoted.append(backslashes * 2, L'\\');
+                break;
+            }
+            quoted.append(*i == L'"' ? backslashes * 2 + 1 : backslashes, L'\\');
+            quoted.push_back(*i);
+        }
+        quoted.push_back(L'"');
+        return quoted;
+    }
+
+    HANDLE handle = nullptr;
+#else
+    pid_t pid = 0;
+#endif
+    uint64_t id = 0;
+};
+
+// version 의 ExecutePath 를 실행한다. 상대 경로는 installPath 기준
+// windows 에서 파일이 아니면(url 등) 연결된 program 으로 연다. command interpreter 를 거치지 않는다. 이때 outProcess 의 id 는 0
+// 그 밖에는 실행할 파일이 없으면 false
+bool Launch(const VersionInfo& version, const filesystem::path& installPath, Process& outProcess)
+{
+    Metrics::Phase phase("launch");
+    error_code ec;
+    const auto& executePath = filesystem::absolute(installPath / filesystem::u8path(version.ExecutePath), ec);
+    if (ec || filesystem::is_regular_file(executePath, ec) == false)
+    {
+#ifdef _WIN32
+        const auto& target = filesystem::u8path(version.ExecutePath).wstring();
+        if (reinterpret_cast<INT_PTR>(ShellExecuteW(nullptr, L"open", target.c_str(), nullptr, nullptr, SW_SHOWNORMAL)) > 32) return true;
+#endif
+        cerr << "could not find the program to launch : " << version.ExecutePath << endl;
+        return false;
+    }
+    auto workingDirectory = filesystem::path();
+    if (version.WorkingDirectory.empty() == false)
+    {
+        workingDirectory = filesystem::absolute(installPath / filesystem::u8path(version.WorkingDirectory), ec);
+        if (ec)
+        {
+            cerr << "invalid working directory : " << version.WorkingDirectory << endl;
+            return false;
+        }
+    }
+    if (outProcess.Start(executePath, version.Arguments, version.Environment, workingDirectory) == false) return false;
+    cout << "started " << version.ExecutePath << " (pid " << outProcess.GetId() << ")" << endl;
+    return true;
+}
+
+const size_t PREFETCH_READ_SIZE = 1024 * 1024;
+
+// update 한 뒤 처음 실행할 때 program 이 읽을 파일들을 미리 page cache 로 올린다. 실행과 함께 threads 개로 나누어 읽는다.
+// posix_fadvise(WILLNEED) 가 있으면 읽기를 예약만 하고 (kernel 이 readahead), 없으면(windows) 끝까지 읽는다.
+class Prefetcher
+{
+public:
+    ~Prefetcher()
+    {
+        Join();
+    }
+
+    // paths 는 installPath 기준
+    void Start(const vector<string>& paths, const filesystem::path& installPath, size_t threads)
+    {
+        begin = chrono::steady_clock::now();
+        for (const auto& p : paths)
+        {
+            const auto& path = installPath / filesystem::u8path(p);
+            error_code ec;
+            if (filesystem::is_directory(path, ec))
+            {
+                for (auto i = filesystem::recursive_directory_iterator(path, ec); !ec && i != filesystem::recursive_directory_iterator(); i.increment(ec))
+                {
+                    if (i->is_regular_file(ec)) files.push_back(i->path());
+                }
+            }
+            else if (filesystem::is_regular_file(path, ec))
+            {
+                files.push_back(path);
+            }
+        }
+        for (size_t i = 0; i < min(max<size_t>(threads, 1), files.size()); ++i) workers.emplace_back([this]() { Read(); });
+    }
+
+    void Join()
+    {
+        if (workers.empty()) return;
+        for (auto& w : workers) w.join();
+        workers.clear();
+        Metrics::GetInstance().Record("prefetch", begin, chrono::steady_clock::now(), prefetchedBytes, files.size());
+        chrono::duration<double> elapsed = chrono::steady_clock::now() - begin;
+        cout << "prefetched " << files.size() << " files (" << prefetchedBytes << " bytes) in " << elapsed.count() << " s" << endl;
+    }
+
+private:
+    void Read()
+    {
+#ifdef POSIX_FADV_WILLNEED
+        for (size_t i; (i = next++) < files.size();)
+        {
+            auto fd = open(files[i].c_str(), O_RDONLY);
+            if (fd < 0) continue;
+            struct stat st;
+            if (fstat(fd, &st) == 0 && posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED) == 0) prefetchedBytes += static_cast<uint64_t>(st.st_size);
+            close(fd);
+        }
+#else
+        vector<char> buffer(PREFETCH_READ_SIZE);
+        for (size_t i; (i = next++) < files.size();)
+        {
+            ifstream stream;
+            OpenFile(stream, files[i], ifstream::binary, nullptr, 0); // 읽는 단위가 크므로 stream 의 buffer 는 쓰지 않는다.
+            while (stream)
+            {
+                stream.read(buffer.data(), static_cast<streamsize>(buffer.size()));
+                prefetchedBytes += static_cast<uint64_t>(stream.gcount());
+            }
+        }
+#endif
+    }
+
+    vector<filesystem::path> files;
+    atomic<size_t> next{ 0 };
+    atomic<uint64_t> prefetchedBytes{ 0 };
+    vector<thread> workers;
+    chrono::steady_clock::time_point begin;
+};
+
 bool Execute(const string& versionFilePath)
 {
     VersionInfo version;
@@ -316,28 +3474,143 @@ bool Execute(const string& versionFilePath)
     if (json.empty()) return false;
     if (version.Load(json) == false) return false;
 
-    stringstream command;
-    command << "start " << version.ExecutePath;
-    system(command.str().c_str());
-    return true;
+    Process process;
+    return Launch(version, filesystem::path(versionFilePath).parent_path(), process);
 }
 
 int main(int argc, const char** argv)
 {
     const auto& VERSION_FILE_NAME = string(u8"version.json");
     const auto& VERSION_TMP_FILE_NAME = string(VERSION_FILE_NAME + u8".tmp");
+    const auto& VERSION_VALIDATOR_FILE_NAME = string(VERSION_FILE_NAME + u8".validator");
     const auto& ZIP_FILE_NAME = string(u8"package.zip");
+    const auto& CHUNK_CACHE_DIR_NAME = string(u8".chunks");
+    const auto& FILE_STATE_INDEX_NAME = string(u8".filestate");
+    const auto& TLS_SESSION_FILE_NAME = string(u8".tlssessions");
+    const auto& STAGING_DIR_NAME = string(u8".staging");
+    const auto& PREVIOUS_DIR_NAME = string(u8".previous");
+    const auto& MANIFEST_FILE_NAME = string(u8"manifest.json");
+    const auto& MANIFEST_TMP_FILE_NAME = string(MANIFEST_FILE_NAME + u8".tmp");
+    const auto& VERSION_FILES = vector<string>{ MANIFEST_FILE_NAME, VERSION_VALIDATOR_FILE_NAME, VERSION_FILE_NAME }; // 적용할 때 마지막이 version file
 
+    Metrics::GetInstance(); // 여기부터 잰다.
     Arguments args(argc, argv);
 
+    // 어느 return 으로 끝나든 metrics 를 저장한다.
+    struct MetricsWriter
+    {
+        string ReportPath;
+        string TracePath;
+
+        ~MetricsWriter()
+        {
+            auto& metrics = Metrics::GetInstance();
+            if (ReportPath.empty() == false) WriteTextTo(ReportPath, metrics.SerializeReport());
+            if (TracePath.empty() == false) WriteTextTo(TracePath, metrics.SerializeTrace());
+        }
+    } metricsWriter{ args.metricsOut.Get(), args.metricsTrace.Get() };
+
+    if (args.tinfl) SetInflateBackend(InflateBackend::TINFL);
+
+    if (args.makeManifest)
+    { // 배포용 manifest 생성
+        const auto& zipPath = filesystem::u8path(args.makeManifest.Get());
+        Manifest manifest;
+        if (MakeManifest(zipPath, manifest) == false) return static_cast<int>(AppResult::FILESYSTEM_ERROR);
+        if (args.chunkUrl && MakeChunks(manifest, zipPath, args.chunkUrl.Get()) == false)
+        {
+            return static_cast<int>(AppResult::FILESYSTEM_ERROR);
+        }
+        if (args.deltaBase && MakeDeltas(manifest, zipPath, filesystem::u8path(args.deltaBase.Get())
+            , args.deltaBaseVersion.Get(), args.deltaUrl.Get()) == false)
+        {
+            return static_cast<int>(AppResult::FILESYSTEM_ERROR);
+        }
+        const auto& manifestPath = zipPath.parent_path() / MANIFEST_FILE_NAME;
+        if (WriteTextTo(manifestPath.u8string(), JS::serializeStruct(manifest)) == false)
+        {
+            return static_cast<int>(AppResult::FILESYSTEM_ERROR);
+        }
+        cout << manifest.Files.size() << " files -> " << manifestPath.u8string() << endl;
+        return static_cast<int>(AppResult::OK);
+    }
+
+    if (args.verify || args.repair)
+    { // 설치된 version 의 manifest 와 비교
+        VersionInfo installed;
+        if (filesystem::exists(VERSION_FILE_NAME) == false || installed.Load(ReadTextFrom(VERSION_FILE_NAME)) == false)
+        {
+            cerr << "no installed version file" << endl;
+            return static_cast<int>(AppResult::VERSION_JOSN_ERROR);
+        }
+        Manifest manifest;
+        if (filesystem::exists(MANIFEST_FILE_NAME)) manifest.Load(ReadTextFrom(MANIFEST_FILE_NAME));
+        else if (installed.ManifestUrl.empty() == false && Download(installed.ManifestUrl, MANIFEST_FILE_NAME))
+        {
+            manifest.Load(ReadTextFrom(MANIFEST_FILE_NAME));
+        }
+        if (manifest.Files.empty())
+        {
+            cerr << "no manifest to verify with ; ManifestUrl is needed in the version file" << endl;
+            return static_cast<int>(AppResult::VERSION_JOSN_ERROR);
+        }
+
+        const auto& installPath = filesystem::path(ZIP_FILE_NAME).parent_path();
+        FileStateIndex fileStates;
+        fileStates.Load(installPath / FILE_STATE_INDEX_NAME);
+        const auto& broken = VerifyManifestFiles(manifest, installPath, args.jobs.Get(), args.ioDepth.Get(), fileStates);
+        auto result = broken.empty() ? AppResult::OK : AppResult::VERIFY_ERROR;
+        if (broken.empty() == false && args.repair)
+        { // 설치된 파일들이 chunk 의 원본
+            result = ReplaceManifestFiles(broken, manifest, manifest, "", installed.ZipFileUrl, installPath, installPath
+                , installPath / CHUNK_CACHE_DIR_NAME, args.connections.Get(), fileStates)
+                ? AppResult::OK
+                : AppResult::REQUEST_ERROR;
+            if (result == AppResult::OK) cout << broken.size() << " files repaired" << endl;
+        }
+        fileStates.Save(installPath / FILE_STATE_INDEX_NAME);
+        return static_cast<int>(result);
+    }
+
+    if (args.rollback)
+    { // 지난 update 가 밀어낸 파일들을 update 로 적용한다. 되돌린 것이 다시 .previous 가 되므로 한 번 더 하면 다시 적용된다.
+        const auto& installPath = filesystem::path(ZIP_FILE_NAME).parent_path();
+        StagedUpdate previous(installPath / PREVIOUS_DIR_NAME);
+        if (previous.IsReady() == false)
+        {
+            cerr << "no previous version to roll back to" << endl;
+            return static_cast<int>(AppResult::FILESYSTEM_ERROR);
+        }
+        StagedUpdate staged(installPath / STAGING_DIR_NAME); // 적용하지 않은 update 는 버린다.
+        staged.Clear();
+        error_code ec;
+        filesystem::rename(installPath / PREVIOUS_DIR_NAME, installPath / STAGING_DIR_NAME, ec); // 중간에 종료되면 다음 실행 때 마저 적용한다.
+        if (ec)
+        {
+            cerr << "could not rename a directory(" << ec.message() << ") : " << PREVIOUS_DIR_NAME << endl;
+            return static_cast<int>(AppResult::FILESYSTEM_ERROR);
+        }
+        FileStateIndex fileStates;
+        fileStates.Load(installPath / FILE_STATE_INDEX_NAME);
+        bool applied = staged.Apply(installPath, VERSION_FILES, fileStates, installPath / PREVIOUS_DIR_NAME);
+        fileStates.Save(installPath / FILE_STATE_INDEX_NAME);
+        if (applied == false) return static_cast<int>(AppResult::FILESYSTEM_ERROR);
+        VersionInfo installed;
+        installed.Load(ReadTextFrom(VERSION_FILE_NAME));
+        cout << "rolled back to version " << installed.Version << endl;
+        return static_cast<int>(AppResult::OK);
+    }
+
     const auto& appPath = filesystem::path(args.GetParser().Prog());
     auto appFileName = appPath.filename();
     auto appConfigName = appFileName.replace_extension(u8"config");
 
     // config load
+    Metrics::Phase configPhase("config");
     AppConfig appConfig;
     bool configExists = filesystem::exists(appConfigName);
     if (configExists) appConfig.Load(ReadTextFrom(appConfigName.u8string()));
+    configPhase.End();
 
     if (argc < 2 && configExists == false)
     {
@@ -349,11 +3622,101 @@ int main(int argc, const char** argv)
         ? args.versionUrl.Get() // override config
         : appConfig.VersionUrl;
 
+    const auto& writeBufferSize = args.writeBuffer.Get() * 1024;
+
+    const auto& installPath = filesystem::path(ZIP_FILE_NAME).parent_path();
+    FileStateIndex fileStates;
+    fileStates.Load(installPath / FILE_STATE_INDEX_NAME);
+
+    // 이번에 update 를 적용했으면 실행하면서 읽을 파일들을 함께 읽어 둔다. (cold start)
+    // --wait 이면 끝날 때까지 기다리며 첫 화면까지와 끝날 때까지 걸린 시간을 알려 준다.
+    vector<string> appliedFiles;
+    bool applied = false;
+    auto launch = [&](const VersionInfo& version, bool wait)
+    {
+        const auto begin = chrono::steady_clock::now();
+        Prefetcher prefetcher;
+        if (applied) prefetcher.Start(version.Prefetch.empty() ? appliedFiles : version.Prefetch, installPath, args.ioDepth.Get());
+        Process process;
+        if (Launch(version, installPath, process) == false) return static_cast<int>(AppResult::EXECUTE_ERROR);
+        prefetcher.Join();
+        if (wait && process.GetId() != 0)
+        {
+            auto elapsed = [&]() { return chrono::duration<double>(chrono::steady_clock::now() - begin).count(); };
+            if (process.WaitForReady()) cout << version.ExecutePath << " is ready in " << elapsed() << " s" << endl;
+            const auto exitCode = process.Wait();
+            cout << version.ExecutePath << " exited with code " << exitCode << " in " << elapsed() << " s" << endl;
+        }
+        return static_cast<int>(AppResult::OK);
+    };
+
+    // 받은 update 는 staging 에 모아 두었다가 한꺼번에 적용한다. 바뀌기 전의 파일들은 .previous 에 남는다.
+    StagedUpdate staged(installPath / STAGING_DIR_NAME);
+    auto applyStaged = [&]()
+    {
+        cout << "applying the staged update .." << endl;
+        applied = staged.Apply(installPath, VERSION_FILES, fileStates, installPath / PREVIOUS_DIR_NAME, &appliedFiles);
+        fileStates.Save(installPath / FILE_STATE_INDEX_NAME);
+        return applied;
+    };
+
+    // 지난 실행에서 받아 둔(또는 적용하다 멈춘) update 가 있으면 실행하기 전에 적용한다.
+    if (staged.IsReady() && applyStaged() == false) return static_cast<int>(AppResult::FILESYSTEM_ERROR);
+
+    // 설치가 끝난 version file 의 validator 로 조건부 요청 ; 304 면 바로 실행한다.
+    CacheValidator validator;
+    if (filesystem::exists(VERSION_FILE_NAME) && filesystem::exists(VERSION_VALIDATOR_FILE_NAME))
+    {
+        validator.Load(ReadTextFrom(VERSION_VALIDATOR_FILE_NAME));
+        if (validator.Url != versionUrl) validator = CacheValidator();
+    }
+    validator.Url = versionUrl;
+    auto saveValidator = [&](const string& filePath) { WriteTextTo(filePath, JS::serializeStruct(validator)); };
+
+    auto& tlsSessions = TlsSessionCache::GetInstance();
+    if (filesystem::exists(TLS_SESSION_FILE_NAME)) tlsSessions.Load(ReadTextFrom(TLS_SESSION_FILE_NAME));
+    auto saveTlsSessions = [&]() { if (tlsSessions.IsChanged()) WriteTextTo(TLS_SESSION_FILE_NAME, tlsSessions.Serialize(), true); };
+
+    // 설치된 version 을 먼저 실행하고 update 는 staging 에 받아 둔다. (다음 실행 때 적용)
+    bool launched = false;
+    if (args.launchFirst || appConfig.LaunchFirst)
+    {
+        VersionInfo installed;
+        if (filesystem::exists(VERSION_FILE_NAME) && installed.Load(ReadTextFrom(VERSION_FILE_NAME))
+            && installed.ExecutePath.empty() == false && filesystem::exists(filesystem::u8path(installed.ExecutePath)))
+        {
+            cout << "running " << installed.ExecutePath << " first, the update will be applied on next launch" << endl;
+            launched = launch(installed, false) == static_cast<int>(AppResult::OK);
+        }
+        else
+        {
+            cout << "no installed version to run first" << endl;
+        }
+    }
+
     cout << "checking version .. " << versionUrl << endl;
-    if (Download(versionUrl, VERSION_TMP_FILE_NAME) == false)
+    Metrics::Phase versionPhase("version");
+    if (Download(versionUrl, VERSION_TMP_FILE_NAME, writeBufferSize, &validator) == false)
     {
         return static_cast<int>(AppResult::REQUEST_ERROR);
     }
+    versionPhase.End();
+    saveTlsSessions();
+
+    if (validator.NotModified)
+    { // no patch needed
+        filesystem::remove(VERSION_TMP_FILE_NAME);
+        staged.Clear(); // 받다 멈춘 다른 version 은 필요 없다.
+        if (launched)
+        {
+            cout << "version file is not modified" << endl;
+            return static_cast<int>(AppResult::OK);
+        }
+        VersionInfo installed;
+        if (installed.Load(ReadTextFrom(VERSION_FILE_NAME)) == false) return static_cast<int>(AppResult::VERSION_JOSN_ERROR);
+        cout << "version file is not modified, running " << installed.ExecutePath << endl;
+        return launch(installed, args.wait);
+    }
 
     VersionInfo newVersion;
     const auto& newVersionJson = ReadTextFrom(VERSION_TMP_FILE_NAME);
@@ -373,30 +3736,106 @@ int main(int argc, const char** argv)
 
     if (newVersion.Version == oldVersion.Version)
     { // no patch needed
+        saveValidator(VERSION_VALIDATOR_FILE_NAME);
+        staged.Clear();
+        if (launched)
+        {
+            cout << "this version is up-to-date" << endl;
+            return static_cast<int>(AppResult::OK);
+        }
         cout << "this version is up-to-date, running " << newVersion.ExecutePath << endl;
-        system((string(u8"start ") + newVersion.ExecutePath).c_str()); // run process
-        return static_cast<int>(AppResult::OK);
+        return launch(newVersion, args.wait);
     }
 
-    // download package
-    cout << "here comes new version... downloading " << newVersion.ZipFileUrl << endl;
-    if (Download(newVersion.ZipFileUrl, ZIP_FILE_NAME) == false)
+    // 설치된 파일은 그대로 두고 바뀐 파일만 staging 에 쓴다. 받다 멈추면 다음 실행 때 이어서 받는다.
+    if (staged.Begin(newVersion.Version) == false) return static_cast<int>(AppResult::FILESYSTEM_ERROR);
+    const auto& outputPath = staged.GetFilesPath();
+    const auto& zipFilePath = staged.GetPath(ZIP_FILE_NAME);
+    const auto& basePath = installPath.empty() ? filesystem::path(u8".") : installPath; // 비어 있으면 ExtractZip 은 dest 와 비교한다.
+
+    // manifest 가 있으면 바뀐 파일만 받는다. 실패하면 전체 package 로
+    bool patched = false;
+    bool hasManifest = false;
+    if (newVersion.ManifestUrl.empty() == false)
     {
-        return static_cast<int>(AppResult::REQUEST_ERROR);
+        cout << "checking manifest .. " << newVersion.ManifestUrl << endl;
+        Manifest newManifest;
+        Manifest oldManifest;
+        if (filesystem::exists(MANIFEST_FILE_NAME)) oldManifest.Load(ReadTextFrom(MANIFEST_FILE_NAME));
+        Metrics::Phase manifestPhase("manifest");
+        hasManifest = Download(newVersion.ManifestUrl, MANIFEST_TMP_FILE_NAME, writeBufferSize)
+            && newManifest.Load(ReadTextFrom(MANIFEST_TMP_FILE_NAME));
+        manifestPhase.End();
+        if (hasManifest)
+        {
+            vector<string> removed;
+            patched = PatchByManifest(newManifest, oldManifest, oldVersion.Version, newVersion.ZipFileUrl, installPath, outputPath
+                , installPath / CHUNK_CACHE_DIR_NAME, args.connections.Get(), fileStates, &removed);
+            if (patched) patched = staged.SetRemoved(removed);
+            if (patched == false) cout << "could not patch by manifest, falling back to the full package" << endl;
+        }
+    }
+    if (hasManifest == false && filesystem::exists(installPath / MANIFEST_FILE_NAME) && staged.SetRemoved({ MANIFEST_FILE_NAME }) == false)
+    { // 새 version 과 맞지 않는 이전 manifest 가 남아 다음 manifest patch 에 쓰이지 않도록
+        return static_cast<int>(AppResult::FILESYSTEM_ERROR);
     }
 
-    // patch
-    cout << "unpacking.." << endl;
-    if (ExtractZipToSourceDir(ZIP_FILE_NAME) == false)
+    if (patched == false)
     {
-        return static_cast<int>(AppResult::FILESYSTEM_ERROR);
+        // download package ; 받는 동안 앞에서부터 도착한 entry 를 바로 푼다.
+        cout << "here comes new version... downloading " << newVersion.ZipFileUrl << endl;
+        DownloadProgress progress;
+        bool extracted = false;
+        thread extractor;
+        if (args.noPipeline == false)
+        {
+            extractor = thread([&]() { extracted = ExtractZipStream(zipFilePath, progress, outputPath, false, args.noIncremental == false, &fileStates, basePath); });
+        }
+        bool downloaded = DownloadSegmented(newVersion.ZipFileUrl, zipFilePath.u8string(), args.connections.Get(), writeBufferSize, &progress);
+        if (downloaded) progress.Complete(filesystem::file_size(zipFilePath));
+        else progress.Abort();
+        if (extractor.joinable()) extractor.join();
+        if (downloaded == false)
+        {
+            return static_cast<int>(AppResult::REQUEST_ERROR);
+        }
+
+        // patch
+        if (extracted == false)
+        {
+            cout << "unpacking.." << endl;
+            if (ExtractZip(zipFilePath, outputPath, false, args.jobs.Get(), args.noIncremental == false, &fileStates, basePath) == false)
+            {
+                return static_cast<int>(AppResult::FILESYSTEM_ERROR);
+            }
+        }
+        filesystem::remove(zipFilePath); // 적용할 때는 필요 없다.
     }
 
-    // update local version file
-    filesystem::remove(VERSION_FILE_NAME);
-    filesystem::rename(VERSION_TMP_FILE_NAME, VERSION_FILE_NAME);
+    fileStates.Save(installPath / FILE_STATE_INDEX_NAME);
+
+    ClientPool::GetInstance().PrintStatistics();
+    tlsSessions.PrintStatistics();
+    saveTlsSessions();
+
+    // version file 들도 staging 에 두었다가 파일들과 함께 적용한다.
+    error_code ec;
+    if (hasManifest) filesystem::rename(MANIFEST_TMP_FILE_NAME, outputPath / MANIFEST_FILE_NAME, ec);
+    if (!ec) filesystem::rename(VERSION_TMP_FILE_NAME, outputPath / VERSION_FILE_NAME, ec);
+    if (ec)
+    {
+        cerr << "could not rename a file(" << ec.message() << ") : " << VERSION_TMP_FILE_NAME << endl;
+        return static_cast<int>(AppResult::FILESYSTEM_ERROR);
+    }
+    saveValidator((outputPath / VERSION_VALIDATOR_FILE_NAME).u8string());
+    if (staged.MarkReady() == false) return static_cast<int>(AppResult::FILESYSTEM_ERROR);
+    if (launched)
+    {
+        cout << "version " << newVersion.Version << " is staged, it will be applied on next launch" << endl;
+        return static_cast<int>(AppResult::OK);
+    }
+    if (applyStaged() == false) return static_cast<int>(AppResult::FILESYSTEM_ERROR);
 
     // run
-    system((string(u8"start ") + newVersion.ExecutePath).c_str()); // run process
-    return static_cast<int>(AppResult::OK);
+    return launch(newVersion, args.wait);
 }
\ No newline at end of file